@@ -0,0 +1,54 @@
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cgroup.hpp"
+#include "macros/assert.hpp"
+
+namespace cgroup {
+auto write(const int dirfd, const char* const file, const std::string_view value) -> int {
+    const auto fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return -errno;
+    }
+    // the kernel validates the value, a partial write does not happen
+    const auto ret = ::write(fd, value.data(), value.size()) < 0 ? -errno : 0;
+    close(fd);
+    return ret;
+}
+
+auto open(const int root, const char* const name) -> int {
+    if(mkdirat(root, name, 0755) != 0 && errno != EEXIST) {
+        line_warn("mkdir() failed: ", strerror(errno));
+        return -1;
+    }
+    // CLONE_INTO_CGROUP does not take O_PATH fds
+    const auto fd = openat(root, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        line_warn("open() failed: ", strerror(errno));
+    }
+    return fd;
+}
+
+auto remove(const int root, const char* const name) -> bool {
+    ensure(unlinkat(root, name, AT_REMOVEDIR) == 0 || errno == ENOENT, "rmdir() failed: ", strerror(errno));
+    return true;
+}
+
+auto kill(const int dirfd) -> bool {
+    const auto ret = write(dirfd, "cgroup.kill", "1");
+    ensure(ret == 0, "cgroup.kill failed: ", strerror(-ret));
+    return true;
+}
+
+auto enable_controllers(const int root) -> void {
+    // one by one, a controller missing in the parent must not disable the others
+    for(const auto controller : {"+cpu", "+memory", "+io"}) {
+        if(const auto ret = write(root, "cgroup.subtree_control", controller); ret != 0) {
+            warn("failed to enable ", controller + 1, " controller: ", strerror(-ret));
+        }
+    }
+}
+} // namespace cgroup
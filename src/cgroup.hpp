@@ -0,0 +1,15 @@
+#pragma once
+#include <string_view>
+
+// cgroup v2 directories of daemons
+namespace cgroup {
+// returns 0 or -errno
+auto write(int dirfd, const char* file, std::string_view value) -> int;
+// creates the child cgroup if needed and returns its directory fd, -1 on error
+auto open(int root, const char* name) -> int;
+auto remove(int root, const char* name) -> bool;
+// kills every process in the cgroup, needs linux 5.14
+auto kill(int dirfd) -> bool;
+// lets children of the root use cpu, memory and io limits
+auto enable_controllers(int root) -> void;
+} // namespace cgroup
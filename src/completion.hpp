@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// one-shot completion flag for a waiter on another thread
+// the waiter may destroy it as soon as wait() returns, so notify() never touches it after the store
+// std::atomic::notify_one() gives no such guarantee, a raw FUTEX_WAKE only uses the address
+class Completion {
+  private:
+    enum : uint32_t {
+        Pending  = 0,
+        Sleeping = 1,
+        Done     = 2,
+    };
+
+    std::atomic_uint32_t state = Pending;
+
+  public:
+    auto wait() -> void {
+        auto current = state.load(std::memory_order_acquire);
+        while(current != Done) {
+            if(current == Pending && !state.compare_exchange_weak(current, Sleeping, std::memory_order_acquire)) {
+                continue;
+            }
+            syscall(SYS_futex, &state, FUTEX_WAIT_PRIVATE, Sleeping, NULL, NULL, 0);
+            current = state.load(std::memory_order_acquire);
+        }
+    }
+
+    auto notify() -> void {
+        // skips the syscall when the waiter has not gone to sleep yet
+        const auto addr = &state;
+        if(state.exchange(Done, std::memory_order_release) == Sleeping) {
+            syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+};
@@ -1,23 +1,41 @@
+#include <bit>
+#include <charconv>
 #include <chrono>
 #include <filesystem>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "daemon.hpp"
 #include "macros.hpp"
+#include "macros/assert.hpp"
 #include "util/split.hpp"
 
 namespace {
 const auto uid = getuid();
 const auto gid = getgid();
 
-const auto state_str = std::array{"init", "up", "want-down", "down", "fail"};
+const auto state_str   = std::array{"init", "up", "want-down", "down", "fail", "wait", "starting", "backoff"};
+const auto file_str    = std::array{"", "args", "state", "pid", "stdout", "stderr", "depends", "ready", "restart", "backoff", "max-restarts", "stop-timeout", "cpu.max", "memory.max", "io.weight", "cpus", "numa", "nice", "sched", "restart-count", "stats"};
+const auto restart_str = std::array{"always", "on-failure", "never"};
+const auto numa_str    = std::array{"", "bind", "interleave", "preferred"};
+const auto sched_str   = std::array{"", "other", "batch", "idle", "fifo", "rr"};
+static_assert(file_str.size() == size_t(FileKind::Limit));
 
-auto is_pid_valid(const State state) {
-    return state == State::Up || state == State::WantDown;
-}
+// passed to daemons of ReadyMode::Notify, the write end of the notify pipe is dup'ed to notify_child_fd
+constexpr auto notify_child_fd = 3;
+char           notify_env[]    = "DAEMONFS_NOTIFY_FD=3";
 
 // modifies args
 auto split_to_argv(std::string& args) -> std::vector<char*> {
@@ -44,6 +62,551 @@ auto memcpy_range(std::string_view file, const size_t offset, const size_t size,
     }
     return copy_len;
 }
+
+auto is_log(const FileKind file) -> bool {
+    return file == FileKind::Stdout || file == FileKind::Stderr;
+}
+
+auto is_setting(const FileKind file) -> bool {
+    return file >= FileKind::Depends && file <= FileKind::Sched;
+}
+
+// field of settings holding the value of a cgroup limit file
+template <class S>
+auto cgroup_limit(S& settings, const FileKind file) -> auto& {
+    return file == FileKind::CpuMax ? settings.cpu_max : file == FileKind::MemoryMax ? settings.memory_max : settings.io_weight;
+}
+
+template <class T>
+auto parse_number(const std::string_view str, T& value) -> bool {
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+// "0-3,8" to bits, false if malformed or a bit is not below limit
+template <class Set>
+auto parse_list(const std::string_view str, const size_t limit, Set set) -> bool {
+    for(const auto elm : split(str, ",")) {
+        const auto dash  = elm.find('-');
+        auto       first = uint32_t();
+        auto       last  = uint32_t();
+        if(!parse_number(elm.substr(0, dash), first)) {
+            return false;
+        }
+        if(dash == std::string_view::npos) {
+            last = first;
+        } else if(!parse_number(elm.substr(dash + 1), last)) {
+            return false;
+        }
+        if(first > last || last >= limit) {
+            return false;
+        }
+        for(auto i = first; i <= last; i += 1) {
+            set(i);
+        }
+    }
+    return true;
+}
+
+// bits to "0-3,8"
+template <class Test>
+auto format_list(const size_t limit, Test test) -> std::string {
+    auto str = std::string();
+    for(auto i = size_t(0); i < limit; i += 1) {
+        if(!test(i)) {
+            continue;
+        }
+        auto last = i;
+        while(last + 1 < limit && test(last + 1)) {
+            last += 1;
+        }
+        str += str.empty() ? "" : ",";
+        str += last == i ? std::to_string(i) : build_string(i, "-", last);
+        i = last;
+    }
+    return str;
+}
+
+auto format_setting(const Settings& settings, const FileKind file) -> std::string {
+    switch(file) {
+    case FileKind::Depends: {
+        auto str = std::string();
+        for(const auto& name : settings.depends) {
+            str += name;
+            str += '\n';
+        }
+        return str;
+    }
+    case FileKind::Ready:
+        if(settings.ready_mode == ReadyMode::Notify) {
+            return "notify";
+        }
+        return std::to_string(settings.ready_delay.count());
+    case FileKind::Restart:
+        return restart_str[int(settings.restart)];
+    case FileKind::Backoff:
+        return std::to_string(settings.backoff_initial.count()) + " " + std::to_string(settings.backoff_max.count());
+    case FileKind::MaxRestarts:
+        return std::to_string(settings.max_restarts);
+    case FileKind::StopTimeout:
+        return std::to_string(settings.stop_timeout.count());
+    case FileKind::CpuMax:
+    case FileKind::MemoryMax:
+    case FileKind::IoWeight:
+        return cgroup_limit(settings, file).empty() ? std::string() : cgroup_limit(settings, file) + "\n";
+    case FileKind::Cpus:
+        if(!settings.cpus) {
+            return {};
+        }
+        return format_list(CPU_SETSIZE, [&settings](const size_t i) { return CPU_ISSET(i, &*settings.cpus); }) + "\n";
+    case FileKind::Numa:
+        if(settings.numa_mode == NumaMode::Default) {
+            return {};
+        }
+        return build_string(numa_str[int(settings.numa_mode)], " ", format_list(64, [&settings](const size_t i) { return (settings.numa_nodes >> i) & 1; }), "\n");
+    case FileKind::Nice:
+        return settings.nice ? build_string(*settings.nice, "\n") : std::string();
+    case FileKind::Sched:
+        if(settings.sched == SchedPolicy::Fifo || settings.sched == SchedPolicy::RoundRobin) {
+            return build_string(sched_str[int(settings.sched)], " ", settings.sched_priority, "\n");
+        }
+        return settings.sched == SchedPolicy::Inherit ? std::string() : build_string(sched_str[int(settings.sched)], "\n");
+    default:
+        return {};
+    }
+}
+
+// returns false if the content is malformed
+auto parse_setting(Settings& settings, const FileKind file, std::string_view str) -> bool {
+    if(!str.empty() && str.back() == '\n') {
+        str.remove_suffix(1);
+    }
+    switch(file) {
+    case FileKind::Depends:
+        settings.depends.clear();
+        for(const auto name : split(str, "\n")) {
+            if(!name.empty()) {
+                settings.depends.emplace_back(name);
+            }
+        }
+        return true;
+    case FileKind::Ready: {
+        if(str == "notify") {
+            settings.ready_mode = ReadyMode::Notify;
+            return true;
+        }
+        auto ms = uint32_t();
+        if(!parse_number(str, ms)) {
+            return false;
+        }
+        settings.ready_mode  = ms == 0 ? ReadyMode::Immediate : ReadyMode::Delay;
+        settings.ready_delay = std::chrono::milliseconds(ms);
+        return true;
+    }
+    case FileKind::Restart:
+        for(auto i = size_t(0); i < restart_str.size(); i += 1) {
+            if(str == restart_str[i]) {
+                settings.restart = RestartPolicy(i);
+                return true;
+            }
+        }
+        return false;
+    case FileKind::Backoff: {
+        // "INITIAL MAX" in milliseconds
+        const auto elms    = split(str, " ");
+        auto       initial = uint32_t();
+        auto       max     = uint32_t();
+        if(elms.size() != 2 || !parse_number(elms[0], initial) || !parse_number(elms[1], max) || initial > max) {
+            return false;
+        }
+        settings.backoff_initial = std::chrono::milliseconds(initial);
+        settings.backoff_max     = std::chrono::milliseconds(max);
+        return true;
+    }
+    case FileKind::MaxRestarts:
+        return parse_number(str, settings.max_restarts);
+    case FileKind::StopTimeout: {
+        auto ms = uint32_t();
+        if(!parse_number(str, ms)) {
+            return false;
+        }
+        settings.stop_timeout = std::chrono::milliseconds(ms);
+        return true;
+    }
+    case FileKind::CpuMax:
+    case FileKind::MemoryMax:
+    case FileKind::IoWeight:
+        // validated by the kernel before this
+        cgroup_limit(settings, file) = str;
+        return !str.empty();
+    // empty resets to inherited
+    case FileKind::Cpus: {
+        if(str.empty()) {
+            settings.cpus.reset();
+            return true;
+        }
+        auto set = cpu_set_t();
+        CPU_ZERO(&set);
+        if(!parse_list(str, CPU_SETSIZE, [&set](const size_t i) { CPU_SET(i, &set); })) {
+            return false;
+        }
+        settings.cpus = set;
+        return true;
+    }
+    case FileKind::Numa: {
+        // "bind 0-1", "interleave 0,2", "preferred 1"
+        settings.numa_mode  = NumaMode::Default;
+        settings.numa_nodes = 0;
+        if(str.empty()) {
+            return true;
+        }
+        const auto elms  = split(str, " ");
+        auto       nodes = uint64_t();
+        if(elms.size() != 2 || !parse_list(elms[1], 64, [&nodes](const size_t i) { nodes |= uint64_t(1) << i; })) {
+            return false;
+        }
+        for(auto i = size_t(1); i < numa_str.size(); i += 1) {
+            if(elms[0] == numa_str[i]) {
+                settings.numa_mode  = NumaMode(i);
+                settings.numa_nodes = nodes;
+            }
+        }
+        return settings.numa_mode != NumaMode::Default && (settings.numa_mode != NumaMode::Preferred || std::has_single_bit(nodes));
+    }
+    case FileKind::Nice: {
+        if(str.empty()) {
+            settings.nice.reset();
+            return true;
+        }
+        auto value = 0;
+        if(!parse_number(str, value) || value < -20 || value > 19) {
+            return false;
+        }
+        settings.nice = value;
+        return true;
+    }
+    case FileKind::Sched: {
+        // "other", "batch", "idle", "fifo PRIORITY", "rr PRIORITY"
+        settings.sched          = SchedPolicy::Inherit;
+        settings.sched_priority = 0;
+        if(str.empty()) {
+            return true;
+        }
+        const auto elms = split(str, " ");
+        for(auto i = size_t(1); i < sched_str.size(); i += 1) {
+            if(!elms.empty() && elms[0] == sched_str[i]) {
+                settings.sched = SchedPolicy(i);
+            }
+        }
+        if(settings.sched == SchedPolicy::Fifo || settings.sched == SchedPolicy::RoundRobin) {
+            return elms.size() == 2 && parse_number(elms[1], settings.sched_priority) && settings.sched_priority >= 1 && settings.sched_priority <= 99;
+        }
+        return settings.sched != SchedPolicy::Inherit && elms.size() == 1;
+    }
+    default:
+        return false;
+    }
+}
+
+auto format_usage(const Usage& usage) -> std::string {
+    const auto sampled = std::chrono::duration_cast<std::chrono::milliseconds>(usage.sampled.time_since_epoch()).count();
+    return build_string("utime-us ", usage.utime_us, "\n",
+                        "stime-us ", usage.stime_us, "\n",
+                        "rss-kib ", usage.rss_kib, "\n",
+                        "max-rss-kib ", usage.max_rss_kib, "\n",
+                        "voluntary-switches ", usage.voluntary_switches, "\n",
+                        "involuntary-switches ", usage.involuntary_switches, "\n",
+                        "read-bytes ", usage.read_bytes, "\n",
+                        "write-bytes ", usage.write_bytes, "\n",
+                        "sampled-ms ", sampled, "\n");
+}
+
+// reads a small procfs file relative to the /proc/<pid> directory
+auto read_proc(const int dirfd, const char* const name, std::span<char> buf) -> std::string_view {
+    const auto fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return {};
+    }
+    const auto len = ::read(fd, buf.data(), buf.size());
+    close(fd);
+    return len > 0 ? std::string_view(buf.data(), len) : std::string_view();
+}
+
+// value of a "key: value" line of status and io
+auto proc_field(const std::string_view text, const std::string_view key) -> uint64_t {
+    auto pos = text.find(key);
+    while(pos != std::string_view::npos && pos != 0 && text[pos - 1] != '\n') {
+        pos = text.find(key, pos + 1);
+    }
+    if(pos == std::string_view::npos) {
+        return 0;
+    }
+    const auto begin = text.find_first_not_of(" \t", pos + key.size());
+    if(begin == std::string_view::npos) {
+        return 0;
+    }
+    auto value = uint64_t();
+    std::from_chars(text.data() + begin, text.data() + text.size(), value);
+    return value;
+}
+
+auto to_us(const timeval& tv) -> uint64_t {
+    return uint64_t(tv.tv_sec) * 1'000'000 + tv.tv_usec;
+}
+
+// struct sched_attr of the kernel, glibc before 2.41 has no sched_setattr()
+struct SchedAttr {
+    uint32_t size = sizeof(SchedAttr);
+    uint32_t policy;
+    uint64_t flags;
+    int32_t  nice;
+    uint32_t priority;
+    uint64_t runtime;
+    uint64_t deadline;
+    uint64_t period;
+};
+
+auto get_sched_attr(const pid_t tid, SchedAttr& attr) -> bool {
+    return syscall(SYS_sched_getattr, tid, &attr, sizeof(attr), 0) == 0;
+}
+
+auto set_sched_attr(const pid_t tid, const SchedAttr& attr) -> bool {
+    return syscall(SYS_sched_setattr, tid, &attr, 0) == 0;
+}
+
+// scheduling of the calling thread with nice and sched applied on top
+auto make_sched_attr(const Settings& settings) -> SchedAttr {
+    constexpr auto policies = std::array{0, SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR};
+
+    auto attr = SchedAttr();
+    get_sched_attr(0, attr);
+    attr.size  = sizeof(attr);
+    attr.flags = 0;
+    if(settings.nice) {
+        attr.nice = *settings.nice;
+    }
+    if(settings.sched != SchedPolicy::Inherit) {
+        attr.policy   = policies[int(settings.sched)];
+        attr.priority = settings.sched_priority;
+    }
+    return attr;
+}
+
+auto has_sched(const Settings& settings) -> bool {
+    return settings.nice || settings.sched != SchedPolicy::Inherit;
+}
+
+auto mempolicy_of(const NumaMode mode) -> int {
+    constexpr auto modes = std::array{MPOL_DEFAULT, MPOL_BIND, MPOL_INTERLEAVE, MPOL_PREFERRED};
+    return modes[int(mode)];
+}
+
+// what the child applies to itself between clone() and execve()
+struct ChildSetup {
+    const SpawnPlan& plan;
+    char* const*     envp;
+    int              stdout_fd;
+    int              stderr_fd;
+    int              notify_fd; // -1 if not passed
+    int              cgroup_fd; // -1 to stay in the cgroup of daemonfs
+    const cpu_set_t* cpus;      // nullptr to inherit
+    int              mempolicy;
+    uint64_t         nodes;
+    const SchedAttr* sched; // nullptr to inherit
+    int              error; // set by the child if it does not reach execve()
+};
+
+// runs on the memory of daemonfs, only async-signal-safe calls and nothing written but setup.error
+auto run_child(void* const arg) -> int {
+    auto& setup = *static_cast<ChildSetup*>(arg);
+    // dispositions are not shared without CLONE_SIGHAND, handlers of daemonfs must not run here
+    for(auto sig = 1; sig < NSIG; sig += 1) {
+        auto action = (struct sigaction){};
+        if(sigaction(sig, NULL, &action) == 0 && action.sa_handler != SIG_DFL && (action.sa_handler != SIG_IGN || sig == SIGPIPE)) {
+            action.sa_handler = SIG_DFL;
+            action.sa_flags   = 0;
+            sigaction(sig, &action, NULL);
+        }
+    }
+    auto ok = true;
+    if(setup.cgroup_fd != -1) {
+        // before the daemon runs any code of its own, so nothing of it ever runs outside of the cgroup
+        const auto procs = openat(setup.cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        ok               = procs >= 0 && ::write(procs, "0", 1) == 1;
+        if(procs >= 0) {
+            close(procs);
+        }
+    }
+    auto set = sigset_t();
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+    const auto null = ::open("/dev/null", O_RDONLY);
+    ok              = ok && setpgid(0, 0) == 0 && null >= 0 && dup2(null, 0) == 0 && dup2(setup.stdout_fd, 1) == 1 && dup2(setup.stderr_fd, 2) == 2;
+    if(null > 0) {
+        close(null);
+    }
+    if(ok && setup.notify_fd != -1) {
+        // dup2() onto itself keeps O_CLOEXEC
+        ok = setup.notify_fd == notify_child_fd ? fcntl(notify_child_fd, F_SETFD, 0) == 0 : dup2(setup.notify_fd, notify_child_fd) == notify_child_fd;
+    }
+    if(ok && setup.cpus != nullptr) {
+        ok = sched_setaffinity(0, sizeof(cpu_set_t), setup.cpus) == 0;
+    }
+    if(ok && setup.mempolicy != MPOL_DEFAULT) {
+        ok = syscall(SYS_set_mempolicy, setup.mempolicy, &setup.nodes, sizeof(setup.nodes) * 8 + 1) == 0;
+    }
+    if(ok && setup.sched != nullptr) {
+        ok = set_sched_attr(0, *setup.sched);
+    }
+    if(ok && chdir(setup.plan.workdir.data()) == 0) {
+        execve(setup.plan.argv[0], setup.plan.argv.data(), setup.envp);
+    }
+    setup.error = errno;
+    _exit(127);
+}
+
+// posix_spawn() can neither run code between clone and execve nor, before glibc 2.41, start the child in a cgroup
+// so this does what it does inside, CLONE_VM | CLONE_VFORK on a stack of its own, and the page tables are never copied
+// returns 0 or an errno like posix_spawn()
+auto clone_and_exec(pid_t& pid, ChildSetup& setup) -> int {
+    constexpr auto stack_size = size_t(64) * 1024;
+    const auto     stack      = mmap(NULL, stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if(stack == MAP_FAILED) {
+        return errno;
+    }
+    // no signal is handled on the shared memory before the child reset the handlers
+    auto all = sigset_t();
+    auto old = sigset_t();
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    setup.error            = 0;
+    pid                    = clone(run_child, static_cast<char*>(stack) + stack_size, CLONE_VM | CLONE_VFORK | SIGCHLD, &setup);
+    const auto clone_error = errno;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    munmap(stack, stack_size);
+    if(pid < 0) {
+        return clone_error;
+    }
+    // CLONE_VFORK returns after execve() or _exit() of the child
+    if(setup.error != 0) {
+        waitpid(pid, NULL, 0);
+    }
+    return setup.error;
+}
+
+auto save_settings(SnapshotWriter& out, const Settings& settings) -> void {
+    out.put(uint32_t(settings.depends.size()));
+    for(const auto& name : settings.depends) {
+        out.put_string(name);
+    }
+    out.put(settings.ready_mode);
+    out.put(settings.ready_delay);
+    out.put(settings.restart);
+    out.put(settings.backoff_initial);
+    out.put(settings.backoff_max);
+    out.put(settings.max_restarts);
+    out.put(settings.stop_timeout);
+    out.put_string(settings.cpu_max);
+    out.put_string(settings.memory_max);
+    out.put_string(settings.io_weight);
+    out.put(settings.cpus);
+    out.put(settings.numa_mode);
+    out.put(settings.numa_nodes);
+    out.put(settings.nice);
+    out.put(settings.sched);
+    out.put(settings.sched_priority);
+}
+
+auto load_settings(SnapshotReader& in, Settings& settings) -> bool {
+    auto count = uint32_t();
+    if(!in.get(count)) {
+        return false;
+    }
+    settings.depends.resize(count);
+    for(auto& name : settings.depends) {
+        in.get_string(name);
+    }
+    in.get(settings.ready_mode);
+    in.get(settings.ready_delay);
+    in.get(settings.restart);
+    in.get(settings.backoff_initial);
+    in.get(settings.backoff_max);
+    in.get(settings.max_restarts);
+    in.get(settings.stop_timeout);
+    in.get_string(settings.cpu_max);
+    in.get_string(settings.memory_max);
+    in.get_string(settings.io_weight);
+    in.get(settings.cpus);
+    in.get(settings.numa_mode);
+    in.get(settings.numa_nodes);
+    in.get(settings.nice);
+    in.get(settings.sched);
+    return in.get(settings.sched_priority);
+}
+
+// capacity, and the bytes still in the ring for an upgrade, stream positions start over
+// periodic snapshots leave the contents out, they would write and sync every ring each time
+auto save_ring(SnapshotWriter& out, const MessageBuffer& ring, const bool live) -> void {
+    out.put(uint64_t(ring.capacity()));
+    if(live) {
+        auto data = std::string(ring.end() - ring.start(), '\0');
+        data.resize(ring.read(0, data));
+        out.put_string(data);
+    }
+}
+
+auto load_ring(SnapshotReader& in, MessageBuffer& ring, const bool live) -> bool {
+    auto capacity = uint64_t();
+    auto data     = std::string();
+    if(!in.get(capacity) || (live && !in.get_string(data))) {
+        return false;
+    }
+    if(capacity != 0) {
+        ring.resize(capacity);
+        ring.write(data);
+    }
+    return true;
+}
+
+auto make_fetch(const MessageBuffer& ring, const LogSpool& spool) -> Followers::Fetch {
+    return [&ring, &spool](Reader& reader, const std::span<char> buf) -> size_t {
+        return read_from(ring, reader, buf, &spool);
+    };
+}
+
+// pages handed to fuse_reply_data(), one per fuse thread
+// the memfd pages themselves can not be handed over, the writer may reuse them before the kernel copied them out
+struct ReplyPipe {
+    std::array<int, 2> fds = {-1, -1};
+
+    auto open() -> bool {
+        if(fds[0] != -1) {
+            return true;
+        }
+        ensure(pipe2(fds.data(), O_CLOEXEC | O_NONBLOCK) == 0, "pipe2() failed: ", strerror(errno));
+        // a larger pipe takes larger reads in one go, the default size works too
+        fcntl(fds[1], F_SETPIPE_SZ, 1024 * 1024);
+        return true;
+    }
+
+    // drops bytes left by a failed reply
+    auto reset() -> void {
+        close();
+        fds = {-1, -1};
+    }
+
+    auto close() -> void {
+        for(const auto fd : fds) {
+            if(fd != -1) {
+                ::close(fd);
+            }
+        }
+    }
+
+    ~ReplyPipe() {
+        close();
+    }
+};
 } // namespace
 
 auto set_timestamp(Stat& stat, const TimePoint& time) -> void {
@@ -53,100 +616,387 @@ auto set_timestamp(Stat& stat, const TimePoint& time) -> void {
     stat.st_atim  = ts;
 }
 
+auto file_kind_from_name(const std::string_view name) -> std::optional<FileKind> {
+    for(auto i = size_t(FileKind::Args); i < file_str.size(); i += 1) {
+        if(name == file_str[i]) {
+            return FileKind(i);
+        }
+    }
+    return std::nullopt;
+}
+
+auto file_kind_name(const FileKind kind) -> const char* {
+    return file_str[size_t(kind)];
+}
+
+auto state_name(const State state) -> const char* {
+    return state_str[size_t(state)];
+}
+
+auto is_running(const State state) -> bool {
+    return state == State::Start || state == State::Up || state == State::WantDown;
+}
+
+auto is_cgroup_limit(const FileKind kind) -> bool {
+    return kind == FileKind::CpuMax || kind == FileKind::MemoryMax || kind == FileKind::IoWeight;
+}
+
+auto is_placement(const FileKind kind) -> bool {
+    return kind >= FileKind::Cpus && kind <= FileKind::Sched;
+}
+
+auto Daemon::prepare_spawn() -> void {
+    spawn_plan.args    = args;
+    spawn_plan.argv    = split_to_argv(spawn_plan.args);
+    spawn_plan.workdir = std::filesystem::path(spawn_plan.argv[0]).parent_path().string();
+}
+
 auto Daemon::start_process() -> bool {
-    auto pipe_stdout = std::array<int, 2>();
-    auto pipe_stderr = std::array<int, 2>();
+    if(spawn_plan.argv.empty()) {
+        // args never change after init, so this is done once
+        prepare_spawn();
+    }
+
+    const auto current     = settings.load();
+    const auto notify      = current->ready_mode == ReadyMode::Notify;
+    auto       pipe_stdout = std::array<int, 2>();
+    auto       pipe_stderr = std::array<int, 2>();
+    auto       pipe_notify = std::array{-1, -1};
     ensure_e(pipe2(pipe_stdout.data(), O_NONBLOCK | O_CLOEXEC) >= 0, false);
-    ensure_e(pipe2(pipe_stderr.data(), O_NONBLOCK | O_CLOEXEC) >= 0, false);
-    pid = fork();
-    if(pid == -1) {
-        warn("fork() failed: ", strerror(errno));
+    if(pipe2(pipe_stderr.data(), O_NONBLOCK | O_CLOEXEC) < 0) {
         close(pipe_stdout[0]);
-        close(pipe_stderr[0]);
         close(pipe_stdout[1]);
-        close(pipe_stderr[1]);
-        return false;
+        bail("pipe2() failed: ", strerror(errno));
     }
-    if(pid != 0) {
-        // parent
-        close(pipe_stdout[1]);
-        close(pipe_stderr[1]);
-        stdout_fd = pipe_stdout[0];
-        stderr_fd = pipe_stderr[0];
-        return true;
+    if(notify && pipe2(pipe_notify.data(), O_NONBLOCK | O_CLOEXEC) < 0) {
+        for(const auto fd : {pipe_stdout[0], pipe_stdout[1], pipe_stderr[0], pipe_stderr[1]}) {
+            close(fd);
+        }
+        bail("pipe2() failed: ", strerror(errno));
+    }
+
+    // the child only runs these actions and execve(), nothing is allocated after the vfork
+    auto actions = posix_spawn_file_actions_t();
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, pipe_stdout[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, pipe_stderr[1], 2);
+    if(notify) {
+        posix_spawn_file_actions_adddup2(&actions, pipe_notify[1], notify_child_fd);
     }
-    // child
-    dup2(open("/dev/null", O_RDONLY | O_CLOEXEC), 0);
-    dup2(pipe_stdout[1], 1);
-    dup2(pipe_stderr[1], 2);
+    posix_spawn_file_actions_addchdir_np(&actions, spawn_plan.workdir.data());
 
-    const auto argv    = split_to_argv(args);
-    const auto workdir = std::filesystem::path(argv[0]).parent_path().string();
-    if(chdir(workdir.data()) == -1) {
-        warn("chdir() failed: ", strerror(errno));
-        _exit(1);
+    // do not pass signal mask of the worker thread, nor SIGPIPE ignored by libfuse, to the daemon
+    auto attr = posix_spawnattr_t();
+    posix_spawnattr_init(&attr);
+    auto empty_set = sigset_t();
+    sigemptyset(&empty_set);
+    posix_spawnattr_setsigmask(&attr, &empty_set);
+    auto default_set = sigset_t();
+    sigemptyset(&default_set);
+    sigaddset(&default_set, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &default_set);
+    // own process group, so that stopping the daemon reaches its children too
+    posix_spawnattr_setpgroup(&attr, 0);
+    auto flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP;
+#ifdef POSIX_SPAWN_SETCGROUP
+    // placed by clone3(CLONE_INTO_CGROUP), so no process of the daemon ever runs outside of its cgroup
+    if(cgroup_fd != -1) {
+        posix_spawnattr_setcgroup_np(&attr, cgroup_fd);
+        flags |= POSIX_SPAWN_SETCGROUP;
     }
+#endif
+    posix_spawnattr_setflags(&attr, flags);
 
-    execve(argv[0], argv.data(), environ);
-    warn("execve() failed: ", strerror(errno));
-    _exit(1);
+    auto envp = std::vector<char*>();
+    if(notify) {
+        for(auto env = environ; *env != nullptr; env += 1) {
+            envp.push_back(*env);
+        }
+        envp.push_back(notify_env);
+        envp.push_back(nullptr);
+    }
+
+    const auto env   = notify ? envp.data() : environ;
+    const auto sched = has_sched(*current) ? std::optional(make_sched_attr(*current)) : std::nullopt;
+#ifdef POSIX_SPAWN_SETCGROUP
+    const auto need_clone = current->cpus || current->numa_mode != NumaMode::Default || sched;
+#else
+    const auto need_clone = current->cpus || current->numa_mode != NumaMode::Default || sched || cgroup_fd != -1;
+#endif
+    auto ret = 0;
+    if(need_clone) {
+        auto setup = ChildSetup{
+            .plan      = spawn_plan,
+            .envp      = env,
+            .stdout_fd = pipe_stdout[1],
+            .stderr_fd = pipe_stderr[1],
+            .notify_fd = pipe_notify[1],
+            .cgroup_fd = cgroup_fd,
+            .cpus      = current->cpus ? &*current->cpus : nullptr,
+            .mempolicy = mempolicy_of(current->numa_mode),
+            .nodes     = current->numa_nodes,
+            .sched     = sched ? &*sched : nullptr,
+        };
+        ret = clone_and_exec(pid, setup);
+    } else {
+        ret = posix_spawn(&pid, spawn_plan.argv[0], &actions, &attr, spawn_plan.argv.data(), env);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(pipe_stdout[1]);
+    close(pipe_stderr[1]);
+    if(notify) {
+        close(pipe_notify[1]);
+    }
+    if(ret != 0) {
+        warn("failed to spawn daemon ", name, ": ", strerror(ret));
+        close(pipe_stdout[0]);
+        close(pipe_stderr[0]);
+        if(notify) {
+            close(pipe_notify[0]);
+        }
+        return false;
+    }
+    stdout_fd = pipe_stdout[0];
+    stderr_fd = pipe_stderr[0];
+    notify_fd = pipe_notify[0];
+    started   = std::chrono::system_clock::now();
+    proc_fd   = open(build_string("/proc/", pid).data(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    usage.store({.sampled = started});
+    return true;
 }
 
 auto Daemon::set_state(const State new_state) -> void {
     state         = new_state;
     state_changed = std::chrono::system_clock::now();
+    transitions += 1;
+    status.store({.state = state, .pid = pid, .restarts = restarts, .state_changed = state_changed, .transitions = transitions});
+}
+
+auto Daemon::save(SnapshotWriter& out, const bool live) const -> void {
+    out.put_string(name);
+    out.put_string(args);
+    out.put(oneshot);
+    out.put(state);
+    out.put(created);
+    out.put(restarts);
+    out.put(backoff_step);
+    save_settings(out, *settings.load());
+    out.put(live);
+    save_ring(out, stdout_buf, live);
+    save_ring(out, stderr_buf, live);
+    if(live) {
+        out.put(pid);
+        out.put(stdout_fd);
+        out.put(stderr_fd);
+        out.put(notify_fd);
+        out.put(started);
+    }
 }
 
-auto Daemon::getattr(const std::string_view file, Stat& stat) const -> int {
+auto Daemon::load(SnapshotReader& in, bool& live) -> bool {
+    auto loaded  = Settings();
+    auto current = State();
+    in.get_string(name);
+    in.get_string(args);
+    in.get(oneshot);
+    in.get(current);
+    in.get(created);
+    in.get(restarts);
+    in.get(backoff_step);
+    ensure(load_settings(in, loaded));
+    ensure(in.get(live));
+    ensure(load_ring(in, stdout_buf, live) && load_ring(in, stderr_buf, live));
+    if(live) {
+        in.get(pid);
+        in.get(stdout_fd);
+        in.get(stderr_fd);
+        in.get(notify_fd);
+        ensure(in.get(started));
+    }
+    state = current;
+    settings.store(std::make_shared<const Settings>(std::move(loaded)));
+    return true;
+}
+
+auto Daemon::apply_placement(const Settings& next, const FileKind file) const -> int {
+    if(file == FileKind::Numa) {
+        // the memory policy of another process can not be changed, so only its pages are moved to the bound nodes
+        // the policy itself takes effect from the next start
+        if(next.numa_mode != NumaMode::Bind) {
+            return 0;
+        }
+        const auto all = ~uint64_t(0);
+        return syscall(SYS_migrate_pages, pid, sizeof(all) * 8 + 1, &all, &next.numa_nodes) < 0 ? -errno : 0;
+    }
+
+    // affinity and scheduling are per thread, children of the daemon are left alone
+    // unset values are reset to those of daemonfs
+    auto cpus = cpu_set_t();
+    if(next.cpus) {
+        cpus = *next.cpus;
+    } else if(sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+        return -errno;
+    }
+    const auto attr = make_sched_attr(next);
+
+    const auto task_fd = openat(proc_fd, "task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(task_fd < 0) {
+        return -errno;
+    }
+    const auto dir = fdopendir(task_fd);
+    if(dir == nullptr) {
+        close(task_fd);
+        return -errno;
+    }
+    auto ret = 0;
+    while(const auto entry = ::readdir(dir)) {
+        auto tid = pid_t();
+        if(!parse_number(entry->d_name, tid)) {
+            continue;
+        }
+        const auto ok = file == FileKind::Cpus ? sched_setaffinity(tid, sizeof(cpus), &cpus) == 0 : set_sched_attr(tid, attr);
+        // threads may exit meanwhile
+        if(!ok && errno != ESRCH) {
+            ret = -errno;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+auto Daemon::sample_usage() -> void {
+    static const auto clock_ticks = uint64_t(sysconf(_SC_CLK_TCK));
+    if(proc_fd == -1) {
+        return;
+    }
+    auto buf  = std::array<char, 4096>();
+    auto next = usage.load();
+
+    // utime and stime are the 14th and 15th fields, counted after the comm which may contain spaces
+    if(const auto stat = read_proc(proc_fd, "stat", buf); !stat.empty()) {
+        auto ptr = stat.data() + stat.rfind(')') + 1;
+        auto end = stat.data() + stat.size();
+        for(auto field = 3; field <= 15 && ptr < end; field += 1) {
+            while(ptr < end && *ptr == ' ') {
+                ptr += 1;
+            }
+            auto value = uint64_t();
+            ptr        = std::from_chars(ptr, end, value).ptr;
+            while(ptr < end && *ptr != ' ') {
+                ptr += 1;
+            }
+            if(field == 14) {
+                next.utime_us = value * 1'000'000 / clock_ticks;
+            } else if(field == 15) {
+                next.stime_us = value * 1'000'000 / clock_ticks;
+            }
+        }
+    }
+    if(const auto status = read_proc(proc_fd, "status", buf); !status.empty()) {
+        next.rss_kib              = proc_field(status, "VmRSS:");
+        next.max_rss_kib          = proc_field(status, "VmHWM:");
+        next.voluntary_switches   = proc_field(status, "voluntary_ctxt_switches:");
+        next.involuntary_switches = proc_field(status, "nonvoluntary_ctxt_switches:");
+    }
+    if(const auto io = read_proc(proc_fd, "io", buf); !io.empty()) {
+        next.read_bytes  = proc_field(io, "read_bytes:");
+        next.write_bytes = proc_field(io, "write_bytes:");
+    }
+    next.sampled = std::chrono::system_clock::now();
+    usage.store(next);
+}
+
+auto Daemon::finish_usage(const rusage& ru) -> void {
+    if(proc_fd != -1) {
+        close(proc_fd);
+        proc_fd = -1;
+    }
+    // rusage counts blocks of 512 bytes, like read_bytes and write_bytes of procfs count storage io
+    usage.store({
+        .utime_us             = to_us(ru.ru_utime),
+        .stime_us             = to_us(ru.ru_stime),
+        .rss_kib              = 0,
+        .max_rss_kib          = uint64_t(ru.ru_maxrss),
+        .voluntary_switches   = uint64_t(ru.ru_nvcsw),
+        .involuntary_switches = uint64_t(ru.ru_nivcsw),
+        .read_bytes           = uint64_t(ru.ru_inblock) * 512,
+        .write_bytes          = uint64_t(ru.ru_oublock) * 512,
+        .sampled              = std::chrono::system_clock::now(),
+    });
+}
+
+auto Daemon::getattr(const FileKind file, Stat& stat) const -> int {
+    const auto current = status.load();
+
     stat.st_nlink = 1;
     stat.st_uid   = uid;
     stat.st_gid   = gid;
     stat.st_mode  = S_IFREG | 0644;
     set_timestamp(stat, created);
-    if(file == "args") {
+    if(file == FileKind::Args) {
+        return 0;
+    }
+    ensure_e(current.state != State::Init, -ENOENT);
+    if(file == FileKind::State) {
+        stat.st_mtim = to_timespec(current.state_changed);
+        return 0;
+    }
+    if(is_setting(file)) {
         return 0;
     }
-    ensure_e(state != State::Init, -ENOENT);
-    if(file == "state") {
-        stat.st_mtim = to_timespec(state_changed);
+    if(file == FileKind::RestartCount || file == FileKind::Stats) {
+        stat.st_mode = S_IFREG | 0444;
         return 0;
     }
-    if(file == "stdout") {
-        stat.st_size = stdout_buf.data.size();
+    if(file == FileKind::Stdout) {
+        stat.st_size = stdout_buf.capacity();
         return 0;
     }
-    if(file == "stderr") {
-        stat.st_size = stderr_buf.data.size();
+    if(file == FileKind::Stderr) {
+        stat.st_size = stderr_buf.capacity();
         return 0;
     }
     stat.st_mode = S_IFREG | 0444;
-    if(file == "pid" && is_pid_valid(state)) {
+    if(file == FileKind::Pid && is_running(current.state)) {
         return 0;
     }
     return -ENOENT;
 }
 
 auto Daemon::readdir(AddDirEntry callback) const -> int {
+    // callback returns false when no more entries are wanted
+    const auto current = status.load();
+
     auto stat    = Stat();
     stat.st_mode = S_IFREG;
-    ensure_e(callback("args", stat), -EIO);
-    if(state == State::Init) {
+    if(!callback(FileKind::Args, stat) || current.state == State::Init) {
         return 0;
     }
-    ensure_e(callback("state", stat), -EIO);
-    if(is_pid_valid(state)) {
-        ensure_e(callback("pid", stat), -EIO);
+    if(!callback(FileKind::State, stat)) {
+        return 0;
+    }
+    if(is_running(current.state) && !callback(FileKind::Pid, stat)) {
+        return 0;
     }
     stat.st_size = 4096;
-    ensure_e(callback("stdout", stat), -EIO);
-    ensure_e(callback("stderr", stat), -EIO);
+    if(!callback(FileKind::Stdout, stat) || !callback(FileKind::Stderr, stat)) {
+        return 0;
+    }
+    stat.st_size = 0;
+    for(auto kind = FileKind::Depends; kind < FileKind::Limit; kind = FileKind(int(kind) + 1)) {
+        if(!callback(kind, stat)) {
+            return 0;
+        }
+    }
     return 0;
 }
 
-auto Daemon::truncate(const std::string_view file, const off_t offset) -> int {
-    if(file == "stdout") {
+auto Daemon::truncate(const FileKind file, const off_t offset) -> int {
+    if(file == FileKind::Stdout) {
         stdout_buf.resize(offset);
-    } else if(file == "stderr") {
+    } else if(file == FileKind::Stderr) {
         stderr_buf.resize(offset);
     } else {
         return -EINVAL;
@@ -154,33 +1004,151 @@ auto Daemon::truncate(const std::string_view file, const off_t offset) -> int {
     return 0;
 }
 
-auto Daemon::read(const std::string_view file, const size_t offset, const size_t size, char* const buffer) const -> int {
-    if(file == "args") {
+auto Daemon::read(const FileKind file, const size_t offset, const size_t size, char* const buffer) const -> int {
+    const auto current = status.load();
+    if(file == FileKind::Args) {
+        // args is written by the worker thread until the state leaves init
+        if(current.state == State::Init) {
+            return 0;
+        }
         return memcpy_range(args, offset, size, buffer, false);
     }
-    ensure_e(state != State::Init, -EINVAL);
-    if(file == "state") {
-        return memcpy_range(state_str[int(state)], offset, size, buffer, false);
+    ensure_e(current.state != State::Init, -EINVAL);
+    if(file == FileKind::State) {
+        return memcpy_range(state_str[int(current.state)], offset, size, buffer, false);
     }
-    if(file == "pid") {
-        ensure_e(is_pid_valid(state), -EINVAL);
-        return memcpy_range(std::to_string(pid), offset, size, buffer, false);
+    if(file == FileKind::Pid) {
+        ensure_e(is_running(current.state), -EINVAL);
+        return memcpy_range(std::to_string(current.pid), offset, size, buffer, false);
     }
-    if(file == "stdout") {
-        return stdout_buf.read(offset, {buffer, size});
+    if(is_setting(file)) {
+        return memcpy_range(format_setting(*settings.load(), file), offset, size, buffer, false);
     }
-    if(file == "stderr") {
-        return stderr_buf.read(offset, {buffer, size});
+    if(file == FileKind::RestartCount) {
+        return memcpy_range(std::to_string(current.restarts), offset, size, buffer, false);
     }
-    return -ENOENT;
+    if(file == FileKind::Stats) {
+        // served from the last sample, the sampler refreshes daemons which were asked for
+        usage_wanted.store(true, std::memory_order_relaxed);
+        return memcpy_range(format_usage(usage.load()), offset, size, buffer, false);
+    }
+    // stdout and stderr are read with read_log()
+    return is_log(file) ? -EINVAL : -ENOENT;
 }
 
-auto Daemon::write(const std::string_view file, const size_t offset, const size_t size, const char* const buffer) -> int {
-    if(file == "args") {
+auto Daemon::read_log(const FileKind file, Reader& reader, const size_t size, char* const buffer) const -> int {
+    ensure_e(is_log(file), -EINVAL);
+    const auto is_stdout = file == FileKind::Stdout;
+    return read_from(is_stdout ? stdout_buf : stderr_buf, reader, {buffer, size}, is_stdout ? &stdout_spool : &stderr_spool);
+}
+
+auto Daemon::read_buf(const FileKind file, Reader& reader, const size_t size, const ReplyBuf& reply) const -> int {
+    if(!is_log(file)) {
+        return -ENOTSUP;
+    }
+    const auto ring = (file == FileKind::Stdout ? stdout_buf : stderr_buf).load();
+    if(ring->memfd == -1) {
+        return -ENOTSUP;
+    }
+    thread_local auto pipe = ReplyPipe();
+    if(!pipe.open()) {
+        return -ENOTSUP;
+    }
+    const auto from = reader.position.load(std::memory_order_relaxed);
+    if(from < ring->start(ring->len.load(std::memory_order_acquire))) {
+        // the overrun marker is built by read_log()
+        return -ENOTSUP;
+    }
+    // only the contiguous part, the reader comes back for the rest
+    // one copy into the pipe, whose pages the kernel moves into the reply without holding up the writer
+    const auto [pos, len] = ring->locate(from, size);
+    if(len == 0) {
+        return -ENOTSUP;
+    }
+    const auto copied = ::write(pipe.fds[1], ring->data.data() + pos, len);
+    // same check as MessageBuffer::read_at(), the copy is thrown away if a write overlapped it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(copied <= 0 || ring->reserved.load(std::memory_order_relaxed) > from + ring->data.size()) {
+        pipe.reset();
+        return -ENOTSUP;
+    }
+    auto buf         = FUSE_BUFVEC_INIT(size_t(copied));
+    buf.buf[0].flags = FUSE_BUF_IS_FD;
+    buf.buf[0].fd    = pipe.fds[0];
+    reader.position.store(from + copied, std::memory_order_relaxed);
+    reply(buf);
+    if(auto left = 0; ioctl(pipe.fds[0], FIONREAD, &left) != 0 || left != 0) {
+        pipe.reset();
+    }
+    return 0;
+}
+
+auto Daemon::write(const FileKind file, const size_t offset, const size_t size, const char* const buffer) -> int {
+    if(file == FileKind::Args) {
         ensure_e(state == State::Init, -EINVAL);
-        set_state(State::Down);
         args.resize(offset + size);
+        // the caller moves the daemon to down, which publishes args to readers
         return memcpy_range(args, offset, size, buffer, true);
     }
+    if(is_setting(file)) {
+        ensure_e(state != State::Init, -EINVAL);
+        ensure_e(offset == 0, -EINVAL);
+        auto updated = Settings(*settings.load());
+        ensure_e(parse_setting(updated, file, {buffer, size}), -EINVAL);
+        if(is_placement(file) && is_running(state)) {
+            // kept only if the kernel takes it
+            const auto ret = apply_placement(updated, file);
+            ensure_e(ret == 0, ret);
+        }
+        settings.store(std::make_shared<const Settings>(std::move(updated)));
+        return size;
+    }
     return -ENOENT;
 }
+
+auto Daemon::open_reader(const FileKind file, Reader& reader) const -> int {
+    ensure_e(is_log(file), -EINVAL);
+    // the oldest byte kept, on disk or in memory
+    const auto is_stdout = file == FileKind::Stdout;
+    reader.position.store(std::min((is_stdout ? stdout_buf : stderr_buf).start(), (is_stdout ? stdout_spool : stderr_spool).start()), std::memory_order_relaxed);
+    return 0;
+}
+
+auto Daemon::follow(const FileKind file, const fuse_req_t req, Reader& reader, const size_t size, const bool nonblock) const -> int {
+    ensure_e(is_log(file), -EINVAL);
+    const auto& ring      = file == FileKind::Stdout ? stdout_buf : stderr_buf;
+    const auto& spool     = file == FileKind::Stdout ? stdout_spool : stderr_spool;
+    auto&       followers = file == FileKind::Stdout ? stdout_followers : stderr_followers;
+    followers.park(req, reader, size, nonblock, make_fetch(ring, spool));
+    return 0;
+}
+
+auto Daemon::poll(const FileKind file, const Reader* const reader, fuse_pollhandle* const handle) const -> unsigned {
+    if(file == FileKind::State && reader != nullptr) {
+        const auto changed = state_followers.poll(reader, handle, [this, reader]() { return status.load().transitions != reader->position.load(std::memory_order_relaxed); });
+        return POLLIN | POLLRDNORM | (changed ? POLLPRI : 0);
+    }
+    if(!is_log(file) || reader == nullptr || !reader->follow) {
+        // only follow reads block
+        if(handle != nullptr) {
+            fuse_pollhandle_destroy(handle);
+        }
+        return POLLIN | POLLRDNORM;
+    }
+    const auto& ring      = file == FileKind::Stdout ? stdout_buf : stderr_buf;
+    auto&       followers = file == FileKind::Stdout ? stdout_followers : stderr_followers;
+    const auto  ready     = followers.poll(reader, handle, [&ring, reader]() { return reader->position.load(std::memory_order_relaxed) < ring.end(); });
+    return ready ? POLLIN | POLLRDNORM : 0;
+}
+
+auto Daemon::wake_followers(const FileKind file) const -> void {
+    if(file == FileKind::State) {
+        // nothing parks reads on the state file
+        state_followers.wake([](Reader& /*reader*/, std::span<char> /*buf*/) { return size_t(0); });
+        return;
+    }
+    const auto& ring      = file == FileKind::Stdout ? stdout_buf : stderr_buf;
+    const auto& spool     = file == FileKind::Stdout ? stdout_spool : stderr_spool;
+    auto&       followers = file == FileKind::Stdout ? stdout_followers : stderr_followers;
+    followers.wake(make_fetch(ring, spool));
+}
@@ -1,17 +1,55 @@
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <span>
 #include <string>
+#include <vector>
+
+#include <sched.h>
+#include <sys/resource.h>
 
 #define FUSE_USE_VERSION 31
-#include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
 
+#include "follow.hpp"
+#include "log-spool.hpp"
 #include "message-buffer.hpp"
+#include "seqlock.hpp"
+#include "snapshot.hpp"
 #include "time.hpp"
+#include "timer-wheel.hpp"
+
+enum class FileKind : uint8_t {
+    Dir = 0,
+    Args,
+    State,
+    Pid,
+    Stdout,
+    Stderr,
+    Depends,
+    Ready,
+    Restart,
+    Backoff,
+    MaxRestarts,
+    StopTimeout,
+    CpuMax,
+    MemoryMax,
+    IoWeight,
+    Cpus,
+    Numa,
+    Nice,
+    Sched,
+    RestartCount,
+    Stats,
+    Limit,
+};
 
 using Stat        = struct stat;
-using AddDirEntry = std::function<bool(const char* const name, const Stat& stat)>;
+using AddDirEntry = std::function<bool(FileKind kind, const Stat& stat)>;
+using ReplyBuf    = std::function<void(fuse_bufvec& buf)>;
 
 enum class State {
     Init = 0,
@@ -19,6 +57,41 @@ enum class State {
     WantDown,
     Down,
     Fail,
+    Wait,    // waiting for dependencies to become up
+    Start,   // running, not ready yet
+    Backoff, // exited, waiting to be restarted
+};
+
+// how a started daemon is considered ready, written to the ready file
+enum class ReadyMode : uint8_t {
+    Immediate, // "0"
+    Delay,     // "N", up for N milliseconds
+    Notify,    // "notify", the daemon writes READY=1 to the fd in $DAEMONFS_NOTIFY_FD
+};
+
+// when an exited daemon is restarted, written to the restart file
+enum class RestartPolicy : uint8_t {
+    Always,
+    OnFailure, // non-zero exit code or killed by a signal
+    Never,
+};
+
+// memory policy of the daemon, written to the numa file as "MODE NODES"
+enum class NumaMode : uint8_t {
+    Default, // inherited
+    Bind,
+    Interleave,
+    Preferred, // takes a single node
+};
+
+// scheduling policy of the daemon, written to the sched file
+enum class SchedPolicy : uint8_t {
+    Inherit,
+    Other,
+    Batch,
+    Idle,
+    Fifo,       // "fifo PRIORITY"
+    RoundRobin, // "rr PRIORITY"
 };
 
 enum class StopResult {
@@ -28,28 +101,143 @@ enum class StopResult {
 };
 
 auto set_timestamp(Stat& stat, const TimePoint& time) -> void;
+auto file_kind_from_name(std::string_view name) -> std::optional<FileKind>;
+auto file_kind_name(FileKind kind) -> const char*;
+// as read from the state file
+auto state_name(State state) -> const char*;
+// true if a process exists in the state
+auto is_running(State state) -> bool;
+// cpu.max, memory.max and io.weight, named after the cgroup file they are written to
+auto is_cgroup_limit(FileKind kind) -> bool;
+// cpus, numa, nice and sched, also applied to the running process when written
+auto is_placement(FileKind kind) -> bool;
+
+// copy of the fields which are read from fuse threads
+struct DaemonStatus {
+    State     state;
+    pid_t     pid;
+    uint32_t  restarts;
+    TimePoint state_changed;
+    uint64_t  transitions;
+};
+
+// resource usage of the current process of the daemon, or of the last one once it exited
+// sampled from procfs while running, taken from wait4() at exit
+struct Usage {
+    uint64_t  utime_us;
+    uint64_t  stime_us;
+    uint64_t  rss_kib; // 0 once exited
+    uint64_t  max_rss_kib;
+    uint64_t  voluntary_switches;
+    uint64_t  involuntary_switches;
+    uint64_t  read_bytes;
+    uint64_t  write_bytes;
+    TimePoint sampled;
+};
+
+// argv and working directory of the daemon, built in the parent before spawning
+struct SpawnPlan {
+    std::string        args; // copy of args with \n replaced by \0, argv points into it
+    std::vector<char*> argv;
+    std::string        workdir;
+};
+
+// written through the files of the daemon directory
+// the worker thread replaces the whole struct on every write, so readers on other threads can keep the one they loaded
+struct Settings {
+    std::vector<std::string>  depends;
+    ReadyMode                 ready_mode      = ReadyMode::Immediate;
+    std::chrono::milliseconds ready_delay     = {};
+    RestartPolicy             restart         = RestartPolicy::Always;
+    std::chrono::milliseconds backoff_initial = std::chrono::milliseconds(100);
+    std::chrono::milliseconds backoff_max     = std::chrono::seconds(30);
+    uint32_t                  max_restarts    = 0; // consecutive restarts before giving up, 0 is unlimited
+    std::chrono::milliseconds stop_timeout    = std::chrono::seconds(10); // from SIGTERM to SIGKILL
+    // cgroup limits as last accepted by the kernel, empty if never written
+    std::string cpu_max;
+    std::string memory_max;
+    std::string io_weight;
+    // applied between clone and execve, empty files inherit from daemonfs
+    std::optional<cpu_set_t> cpus; // "0-3,8"
+    NumaMode                 numa_mode      = NumaMode::Default;
+    uint64_t                 numa_nodes     = 0; // bitmask, nodes above 63 are not supported
+    std::optional<int>       nice;
+    SchedPolicy              sched          = SchedPolicy::Inherit;
+    uint32_t                 sched_priority = 0; // for fifo and rr
+};
 
 struct Daemon {
     std::string   name;
     std::string   args;
+    uint32_t      slot          = 0;
+    uint64_t      generation    = 0;
     State         state : 7     = State::Init;
     bool          oneshot       = false;
     TimePoint     created       = std::chrono::system_clock::now();
     TimePoint     state_changed = created;
+    uint64_t      transitions   = 0; // set_state() calls, pollers of the state file compare it with their reader
     MessageBuffer stdout_buf;
     MessageBuffer stderr_buf;
+    LogSpool      stdout_spool; // open only if daemonfs has a log directory
+    LogSpool      stderr_spool;
 
     // child process state
-    int   stdout_fd = -1;
-    int   stderr_fd = -1;
-    pid_t pid;
+    SpawnPlan spawn_plan;
+    int       stdout_fd = -1;
+    int       stderr_fd = -1;
+    int       notify_fd = -1;
+    int       pidfd     = -1;
+    int       proc_fd   = -1; // /proc/<pid>, so that samples never read a reused pid
+    int       cgroup_fd = -1; // own cgroup, created on the first start or limit write if cgroups are enabled
+    pid_t     pid;
+    TimePoint started;
+    TimerNode timer;            // ready delay in start, restart backoff in backoff, stop timeout in want-down
+    uint32_t  restarts     = 0; // since the last up
+    uint32_t  backoff_step = 0; // restarts since the last run which outlived backoff_max
 
+    // fields above are owned by the worker thread
+    // readers on other threads must go through these
+    // stdout_buf, stderr_buf and the spools are safe to read from any thread
+    SeqLock<DaemonStatus>                        status;
+    SeqLock<Usage>                               usage;
+    mutable std::atomic_bool                     usage_wanted = false; // set by readers of stats, cleared by the sampler
+    std::atomic<std::shared_ptr<const Settings>> settings     = std::make_shared<const Settings>();
+    mutable Followers                            stdout_followers;
+    mutable Followers                            stderr_followers;
+    mutable Followers                            state_followers; // only polls
+
+    auto prepare_spawn() -> void;
     auto start_process() -> bool;
     auto set_state(State new_state) -> void;
+    // applies a placement setting to every thread of the running process, returns 0 or -errno
+    auto apply_placement(const Settings& next, FileKind file) const -> int;
+    // worker thread
+    // live adds the process and the read ends of its pipes, which survive an exec of daemonfs
+    auto save(SnapshotWriter& out, bool live) const -> void;
+    // live is set if the process was saved too, state is left to the caller
+    auto load(SnapshotReader& in, bool& live) -> bool;
+    // worker thread, while the process is running
+    auto sample_usage() -> void;
+    // worker thread, after the process was reaped
+    auto finish_usage(const rusage& ru) -> void;
 
-    auto getattr(std::string_view file, Stat& stat) const -> int;
+    auto getattr(FileKind file, Stat& stat) const -> int;
     auto readdir(AddDirEntry callback) const -> int;
-    auto truncate(std::string_view file, off_t offset) -> int;
-    auto read(std::string_view file, size_t offset, size_t size, char* buffer) const -> int;
-    auto write(std::string_view file, size_t offset, size_t size, const char* buffer) -> int;
+    auto truncate(FileKind file, off_t offset) -> int;
+    auto read(FileKind file, size_t offset, size_t size, char* buffer) const -> int;
+    // reads stdout or stderr from the cursor of the open file
+    auto read_log(FileKind file, Reader& reader, size_t size, char* buffer) const -> int;
+    // replies through a pipe filled from the memfd of the ring, which libfuse splices into the reply
+    // returns 0 if replied, -ENOTSUP if the file is not backed by a memfd or the range was overwritten
+    auto read_buf(FileKind file, Reader& reader, size_t size, const ReplyBuf& reply) const -> int;
+    auto write(FileKind file, size_t offset, size_t size, const char* buffer) -> int;
+
+    // cursors and follow mode of stdout and stderr
+    auto open_reader(FileKind file, Reader& reader) const -> int;
+    auto follow(FileKind file, fuse_req_t req, Reader& reader, size_t size, bool nonblock) const -> int;
+    // stdout and stderr are readable when a follow read would not block
+    // state reports POLLPRI once it changed since the reader was opened or last read, like sysfs attributes
+    auto poll(FileKind file, const Reader* reader, fuse_pollhandle* handle) const -> unsigned;
+    // worker thread, after appending to the ring or changing the state
+    auto wake_followers(FileKind file) const -> void;
 };
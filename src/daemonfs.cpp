@@ -1,17 +1,27 @@
+#include <unordered_set>
+
 #include <bits/ioctl.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <poll.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/reboot.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include "cgroup.hpp"
 #include "daemonfs.hpp"
 #include "macros.hpp"
+#include "macros/assert.hpp"
 #include "macros/unwrap.hpp"
+#include "metrics.hpp"
 #include "signal.hpp"
+#include "status.hpp"
 #include "util/split.hpp"
 
 namespace {
@@ -36,77 +46,736 @@ auto extract_string(const std::string& data) -> std::string_view {
     return str;
 }
 
-auto sigchild_count = std::atomic_int();
+const auto root_file_str = std::array{".metrics", ".events", ".status", ".status.bin", ".control"};
+static_assert(root_file_str.size() == size_t(ino::RootFile::Limit));
+
+auto root_file_attr(const ino::RootFile file, const TimePoint& created, Stat& stat) -> void {
+    stat.st_mode  = S_IFREG | (file == ino::RootFile::Control ? 0644 : 0444);
+    stat.st_nlink = 1;
+    stat.st_uid   = uid;
+    stat.st_gid   = gid;
+    stat.st_ino   = ino::make_root(file);
+    set_timestamp(stat, created);
+}
+
+auto copy_range(const std::string_view file, const size_t offset, const size_t size, char* const buffer) -> int {
+    if(offset >= file.size()) {
+        return 0;
+    }
+    const auto len = std::min(size, file.size() - offset);
+    std::memcpy(buffer, file.data() + offset, len);
+    return len;
+}
+
+// how long the kernel may cache attributes and entries
+// they only change with the state, which sends invalidations, or through the kernel itself, as mkdir, rmdir and truncate do
+constexpr auto cache_timeout = 3600.0;
+
+auto fill_attr(const Daemon& daemon, const FileKind kind, Stat& stat) -> int {
+    if(kind == FileKind::Dir) {
+        dir_attr(stat);
+        set_timestamp(stat, daemon.created);
+    } else if(const auto ret = daemon.getattr(kind, stat); ret != 0) {
+        return ret;
+    }
+    stat.st_ino = ino::make(daemon.slot, kind);
+    return 0;
+}
+
+auto fill_entry(const Daemon& daemon, const FileKind kind, fuse_entry_param& entry) -> int {
+    if(const auto ret = fill_attr(daemon, kind, entry.attr); ret != 0) {
+        return ret;
+    }
+    entry.ino           = entry.attr.st_ino;
+    entry.generation    = daemon.generation;
+    entry.attr_timeout  = cache_timeout;
+    entry.entry_timeout = cache_timeout;
+    return 0;
+}
+
+// appends directory entries until the size requested by the kernel is reached
+struct DirBuffer {
+    fuse_req_t         req;
+    std::vector<char>& buf;
+    size_t             limit;
+
+    auto add(const char* const name, const fuse_ino_t ino, const mode_t mode, const off_t next) -> bool {
+        auto stat    = Stat();
+        stat.st_ino  = ino;
+        stat.st_mode = mode;
+
+        const auto used = buf.size();
+        const auto len  = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+        if(used + len > limit) {
+            return false;
+        }
+        buf.resize(used + len);
+        fuse_add_direntry(req, buf.data() + used, len, name, &stat, next);
+        return true;
+    }
+};
+
+// low bits of epoll_event::data for daemon fds
+enum DaemonEvent : uintptr_t {
+    Stdout = 0,
+    Stderr = 1,
+    Exit   = 2,
+    Notify = 3,
+    Mask   = 3,
+};
+
+static_assert(alignof(Daemon) > DaemonEvent::Mask);
 
-auto sigchild_handler(int) -> void {
-    sigchild_count.fetch_add(1);
+// bumped whenever the layout of the snapshot changes
+constexpr auto snapshot_magic = uint64_t(0x33'70'61'6e'73'73'66'64); // "dfssnap3"
+
+auto tag(Daemon& daemon, const DaemonEvent event) -> void* {
+    return std::bit_cast<void*>(std::bit_cast<uintptr_t>(&daemon) | event);
+}
+
+auto pidfd_open(const pid_t pid) -> int {
+    return syscall(SYS_pidfd_open, pid, 0);
 }
 } // namespace
 
 auto DaemonFS::find_daemon(const std::string_view name) -> Daemon* {
-    auto daemon_it = std::ranges::find_if(daemons, [name](auto& d) { return d->name == name; });
-    if(daemon_it == daemons.end()) {
-        return nullptr;
+    return daemons.find(name);
+}
+
+auto DaemonFS::set_state(Daemon& daemon, const State state) -> void {
+    const auto old = daemon.state;
+    daemon.set_state(state);
+    // mtime of the state file
+    invalidate(ino::make(daemon.slot, FileKind::State), nullptr);
+    if(is_running(old) && !is_running(state)) {
+        invalidate(ino::make(daemon.slot, FileKind::Dir), file_kind_name(FileKind::Pid));
     }
-    return daemon_it->get();
+    daemon.wake_followers(FileKind::State);
+    status_changed();
+
+    // "MS OLD NEW NAME", the name goes last since it may contain spaces
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(daemon.state_changed.time_since_epoch()).count();
+    events.write(build_string(ms, " ", state_name(old), " ", state_name(state), " ", daemon.name, "\n"));
+    event_followers.wake(fetch_events());
+}
+
+auto DaemonFS::fetch_events() const -> Followers::Fetch {
+    return [this](Reader& reader, const std::span<char> buf) -> size_t {
+        return read_from(events, reader, buf);
+    };
 }
 
-auto DaemonFS::find_daemon_and_filename(std::string_view path) -> std::pair<Daemon*, std::string_view> {
-    const auto elms = split(path, "/");
-    if(elms.size() != 2) {
-        return {nullptr, ""};
+auto DaemonFS::invalidate(const fuse_ino_t ino, const char* const name) -> void {
+    const auto lock = std::lock_guard(notify_lock);
+    if(session == nullptr) {
+        // not mounted, nothing is cached
+        return;
     }
-    const auto name   = elms[0];
-    const auto file   = elms[1];
-    const auto daemon = find_daemon(name);
-    return {daemon, file};
+    invalidations.push_back({ino, name});
+    notify_cond.notify_one();
+}
+
+auto DaemonFS::run_notifier() -> void {
+    auto batch = std::vector<Invalidation>();
+    while(true) {
+        auto se = (fuse_session*)(nullptr);
+        {
+            auto lock = std::unique_lock(notify_lock);
+            notify_cond.wait(lock, [this]() { return notifier_stop || !invalidations.empty(); });
+            if(notifier_stop) {
+                return;
+            }
+            std::swap(batch, invalidations);
+            se = session;
+        }
+        // -ENOENT only means that the kernel did not cache it
+        for(const auto& inval : batch) {
+            if(inval.name == nullptr) {
+                fuse_lowlevel_notify_inval_inode(se, inval.ino, -1, 0);
+            } else {
+                fuse_lowlevel_notify_inval_entry(se, inval.ino, inval.name, strlen(inval.name));
+            }
+        }
+        batch.clear();
+    }
+}
+
+auto DaemonFS::start_notifier(fuse_session* const session) -> void {
+    this->session = session;
+    notifier      = std::thread([this]() { run_notifier(); });
+}
+
+auto DaemonFS::stop_notifier() -> void {
+    {
+        const auto lock = std::lock_guard(notify_lock);
+        notifier_stop   = true;
+        session         = nullptr;
+        invalidations.clear();
+    }
+    notify_cond.notify_one();
+    notifier.join();
+}
+
+auto DaemonFS::find_daemon_by_ino(const fuse_ino_t ino) -> Daemon* {
+    return ino::is_daemon(ino) ? daemons.at(ino::slot_of(ino)) : nullptr;
+}
+
+auto DaemonFS::load_daemon_by_ino(const fuse_ino_t ino) const -> std::shared_ptr<const Daemon> {
+    return ino::is_daemon(ino) ? daemons.load(ino::slot_of(ino)) : nullptr;
 }
 
 auto DaemonFS::start_daemon(Daemon& daemon) -> bool {
-    ensure(daemon.start_process());
-    daemon.set_state(State::Up);
-
-    static_assert(alignof(Daemon) % 2 == 0);
-    auto event = epoll_event{.events = EPOLLIN, .data = {.ptr = &daemon}};
-    ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, daemon.stdout_fd, &event) == 0, strerror(errno));
-    event.data.ptr = (void*)(uintptr_t(&daemon) | 1);
-    ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, daemon.stderr_fd, &event) == 0, strerror(errno));
+    if(!open_cgroup(daemon) || !daemon.start_process()) {
+        // exec failures are reported by posix_spawn(), no child is left behind
+        set_state(daemon, State::Fail);
+        reschedule = true;
+        return false;
+    }
+    const auto settings = daemon.settings.load();
+    if(settings->ready_mode == ReadyMode::Immediate) {
+        set_state(daemon, State::Up);
+        reschedule = true;
+    } else {
+        set_state(daemon, State::Start);
+    }
+    watch_daemon(daemon);
+    if(settings->ready_mode == ReadyMode::Delay) {
+        add_timer(daemon, settings->ready_delay);
+    }
+    return true;
+}
+
+auto DaemonFS::watch_daemon(Daemon& daemon) -> void {
+    daemons.bind_pid(daemon);
+    live += 1;
+
+    // pipes of an adopted daemon may have been closed by the daemon already
+    auto event = epoll_event{.events = EPOLLIN};
+    for(const auto& [fd, kind] : {std::pair{daemon.stdout_fd, DaemonEvent::Stdout}, {daemon.stderr_fd, DaemonEvent::Stderr}, {daemon.notify_fd, DaemonEvent::Notify}}) {
+        if(fd == -1) {
+            continue;
+        }
+        event.data.ptr = tag(daemon, kind);
+        ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) == 0, strerror(errno));
+    }
+    if(sigchld_fd == -1) {
+        daemon.pidfd = pidfd_open(daemon.pid);
+        if(daemon.pidfd >= 0) {
+            event.data.ptr = tag(daemon, DaemonEvent::Exit);
+            ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, daemon.pidfd, &event) == 0, strerror(errno));
+            return;
+        }
+        // daemons watched through pidfd already keep it
+        warn("pidfd_open() failed, using signalfd instead: ", strerror(errno));
+        ensure(open_sigchld_fd());
+    }
+}
+
+auto DaemonFS::stop_daemon(Daemon& daemon) -> void {
+    set_state(daemon, State::WantDown);
+    add_timer(daemon, daemon.settings.load()->stop_timeout);
+    // the whole process group, children of shell scripts included
+    if(kill(-daemon.pid, SIGTERM) != 0) {
+        line_warn("kill() failed: ", strerror(errno));
+    }
+}
+
+auto DaemonFS::open_cgroup(Daemon& daemon) -> bool {
+    if(cgroup_root == -1 || daemon.cgroup_fd != -1) {
+        return true;
+    }
+    daemon.cgroup_fd = cgroup::open(cgroup_root, daemon.name.data());
+    return daemon.cgroup_fd != -1;
+}
+
+auto DaemonFS::mark_ready(Daemon& daemon) -> void {
+    ensure(remove_fd_from_epollfds(daemon.notify_fd));
+    if(daemon.state != State::Start) {
+        return;
+    }
+    set_state(daemon, State::Up);
+    reschedule = true;
+}
+
+auto DaemonFS::read_notify(Daemon& daemon) -> void {
+    // sd_notify style, a message containing READY=1 makes the daemon ready
+    auto buf = std::array<char, 512>();
+    while(true) {
+        const auto len = ::read(daemon.notify_fd, buf.data(), buf.size());
+        if(len < 0 && errno == EAGAIN) {
+            return;
+        }
+        if(len <= 0) {
+            // closed without telling, the daemon stays in start until it exits
+            ensure(remove_fd_from_epollfds(daemon.notify_fd));
+            return;
+        }
+        if(std::string_view(buf.data(), len).find("READY=1") != std::string_view::npos) {
+            mark_ready(daemon);
+            return;
+        }
+    }
+}
+
+auto DaemonFS::add_timer(Daemon& daemon, const std::chrono::nanoseconds delay) -> void {
+    daemon.timer.data = &daemon;
+    add_timer(daemon.timer, delay);
+}
+
+auto DaemonFS::add_timer(TimerNode& node, const std::chrono::nanoseconds delay) -> void {
+    // rounded up, timers never fire early
+    const auto elapsed = std::chrono::steady_clock::now() + delay - timers_base;
+    const auto expiry  = TimerWheel::Tick(std::chrono::ceil<std::chrono::milliseconds>(elapsed).count());
+    timers.arm(node, expiry);
+    if(armed_tick == 0 || node.expiry < armed_tick) {
+        arm_timer();
+    }
+}
+
+auto DaemonFS::cancel_timer(Daemon& daemon) -> void {
+    // timer_fd is left armed, an early wakeup finds nothing to fire
+    timers.cancel(daemon.timer);
+}
+
+auto DaemonFS::arm_timer() -> void {
+    // zero disarms the timer
+    auto       spec = itimerspec();
+    const auto next = timers.next_event();
+    armed_tick      = next.value_or(0);
+    if(next) {
+        const auto deadline   = (timers_base + std::chrono::milliseconds(*next)).time_since_epoch();
+        const auto sec        = std::chrono::duration_cast<std::chrono::seconds>(deadline);
+        spec.it_value.tv_sec  = sec.count();
+        spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - sec).count();
+    }
+    ensure(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0, strerror(errno));
+}
+
+auto DaemonFS::fire_timers() -> void {
+    auto buf = uint64_t();
+    ::read(timer_fd, &buf, sizeof(buf));
+
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - timers_base);
+    // a handler may arm any expired node again, the sampler restarts daemons it reaps, which rewrites its links
+    expired.clear();
+    for(auto node = timers.advance(now.count()); node != nullptr; node = node->next) {
+        expired.push_back(node);
+    }
+    for(const auto node : expired) {
+        if(node->is_armed()) {
+            // armed again by an earlier handler, this expiry is stale
+            continue;
+        }
+        if(node == &sampler) {
+            sample_usages();
+            continue;
+        }
+        if(node == &snapshotter) {
+            save_snapshot(false);
+            continue;
+        }
+        auto& daemon = *static_cast<Daemon*>(node->data);
+        if(daemon.state == State::Start) {
+            mark_ready(daemon);
+        } else if(daemon.state == State::Backoff) {
+            print("restarting daemon ", daemon.name);
+            start_daemon(daemon);
+        } else if(daemon.state == State::WantDown) {
+            // the leader may be a zombie already, its process group is still valid until it is reaped
+            // the cgroup also reaches processes which left the group, kernels before 5.14 lack cgroup.kill
+            print("daemon ", daemon.name, " did not stop in time, killing");
+            if(daemon.cgroup_fd == -1 || !cgroup::kill(daemon.cgroup_fd)) {
+                kill(-daemon.pid, SIGKILL);
+            }
+        }
+    }
+    arm_timer();
+}
+
+auto DaemonFS::sample_usages() -> void {
+    const auto expiry = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() + sample_interval - timers_base);
+    timers.arm(sampler, expiry.count());
+    flush_spools();
+    if(sigchld_fd != -1) {
+        // a signalfd opened by watch_daemon() misses the SIGCHLDs taken by fuse threads, which do not block it
+        reap_children();
+    }
+    if(!usage_wanted.exchange(false, std::memory_order_relaxed)) {
+        return;
+    }
+    // procfs reads are a few syscalls each, so one round is bounded and the rest waits for the next one
+    auto budget = sample_batch;
+    for(auto i = uint32_t(0), count = daemons.size(); i < count && budget > 0; i += 1) {
+        sample_cursor     = sample_cursor + 1 < count ? sample_cursor + 1 : 0;
+        const auto daemon = daemons.at(sample_cursor);
+        if(daemon == nullptr || daemon->proc_fd == -1 || !daemon->usage_wanted.exchange(false, std::memory_order_relaxed)) {
+            continue;
+        }
+        daemon->sample_usage();
+        budget -= 1;
+    }
+    if(budget == 0) {
+        usage_wanted.store(true, std::memory_order_relaxed);
+    }
+}
+
+auto DaemonFS::open_spools(Daemon& daemon) -> void {
+    if(log_root == -1) {
+        return;
+    }
+    // not fatal, the output stays in memory only
+    if(!daemon.stdout_spool.open(log_root, daemon.name, "stdout", daemon.stdout_buf.end()) ||
+       !daemon.stderr_spool.open(log_root, daemon.name, "stderr", daemon.stderr_buf.end())) {
+        warn("log spooling disabled for ", daemon.name);
+    }
+}
+
+auto DaemonFS::flush_spools() -> void {
+    if(log_root == -1) {
+        return;
+    }
+    daemons.for_each([](Daemon& daemon) {
+        daemon.stdout_spool.append(daemon.stdout_buf);
+        daemon.stderr_spool.append(daemon.stderr_buf);
+    });
+}
+
+auto DaemonFS::save_snapshot(const bool live) -> bool {
+    timers.cancel(snapshotter);
+    if(snapshot_path == nullptr) {
+        return true;
+    }
+    auto count = uint32_t(0);
+    daemons.for_each([&count](const Daemon& /*daemon*/) { count += 1; });
+
+    // only the daemonfs exec'ed with the token owns the children, a reboot reusing the pid must not adopt stale fds
+    if(live) {
+        auto device  = std::random_device();
+        resume_token = (uint64_t(device()) << 32 | device()) | 1;
+    }
+    auto out = SnapshotWriter();
+    out.put(snapshot_magic);
+    out.put(live ? resume_token : uint64_t(0));
+    out.put(count);
+    daemons.for_each([&out, live](const Daemon& daemon) {
+        daemon.save(out, live && is_running(daemon.state));
+    });
+    return write_snapshot_file(snapshot_path, out.data());
+}
+
+auto DaemonFS::load_snapshot() -> bool {
+    auto file = MappedFile();
+    if(!file.open(snapshot_path)) {
+        return true;
+    }
+    auto in    = SnapshotReader(file.contents());
+    auto magic = uint64_t();
+    auto token = uint64_t();
+    auto count = uint32_t();
+    if(!in.get(magic) || magic != snapshot_magic) {
+        warn("ignoring snapshot of another version");
+        return true;
+    }
+    ensure(in.get(token) && in.get(count));
+    resumed = token != 0 && token == resume_token;
+    for(auto i = uint32_t(0); i < count; i += 1) {
+        const auto created            = std::shared_ptr<Daemon>(new Daemon());
+        created->stdout_buf.use_memfd = zero_copy;
+        created->stderr_buf.use_memfd = zero_copy;
+        auto live                     = false;
+        ensure(created->load(in, live));
+        if(!resumed && created->oneshot) {
+            // run again by main()
+            continue;
+        }
+        const auto daemon = daemons.insert(created);
+        ensure(daemon != nullptr);
+        open_spools(*daemon);
+        if(!resumed) {
+            // children of the previous daemonfs are not ours, only the definitions are taken
+            daemon->stdout_fd = -1;
+            daemon->stderr_fd = -1;
+            daemon->notify_fd = -1;
+            set_state(*daemon, daemon->state == State::Init ? State::Init : State::Down);
+            continue;
+        }
+        if(live) {
+            adopt_daemon(*daemon);
+            continue;
+        }
+        set_state(*daemon, daemon->state);
+        if(daemon->state == State::Wait) {
+            waiting.push_back(daemon);
+            reschedule = true;
+        } else if(daemon->state == State::Backoff) {
+            // the remaining delay is not saved, the shortest one is taken
+            add_timer(*daemon, daemon->settings.load()->backoff_initial);
+        }
+    }
+    print("loaded ", count, " daemons from ", snapshot_path, resumed ? ", resumed" : "");
     return true;
 }
 
-auto DaemonFS::wait_daemon_process() -> void {
+auto DaemonFS::adopt_daemon(Daemon& daemon) -> void {
+    for(const auto fd : {daemon.stdout_fd, daemon.stderr_fd, daemon.notify_fd}) {
+        if(fd != -1) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if(!open_cgroup(daemon)) {
+        warn("daemon ", daemon.name, " is adopted without its cgroup");
+    }
+    daemon.proc_fd = ::open(build_string("/proc/", daemon.pid).data(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    daemon.usage.store({.sampled = daemon.started});
+    // a daemon which exited meanwhile is a zombie, its pidfd is readable at once
+    set_state(daemon, daemon.state);
+    watch_daemon(daemon);
+
+    // the remaining delays are not saved, they start over
+    const auto settings = daemon.settings.load();
+    if(daemon.state == State::Start && settings->ready_mode == ReadyMode::Delay) {
+        add_timer(daemon, settings->ready_delay);
+    } else if(daemon.state == State::WantDown) {
+        add_timer(daemon, settings->stop_timeout);
+    }
+}
+
+auto DaemonFS::request_upgrade() -> void {
+    auto info = signalfd_siginfo();
+    while(::read(upgrade_fd, &info, sizeof(info)) == sizeof(info)) {
+    }
+    if(shutting_down || upgrading) {
+        return;
+    }
+    print("upgrading daemonfs");
+    // the main thread, whose tid is the pid, ends the fuse session and sends Upgrade
+    upgrading = true;
+    syscall(SYS_tgkill, getpid(), getpid(), SIGTERM);
+}
+
+auto DaemonFS::restart_daemon(Daemon& daemon, const bool failed) -> void {
+    const auto settings = daemon.settings.load();
+    if(settings->restart == RestartPolicy::Never || (settings->restart == RestartPolicy::OnFailure && !failed)) {
+        set_state(daemon, failed ? State::Fail : State::Down);
+        reschedule = true;
+        return;
+    }
+    if(std::chrono::system_clock::now() - daemon.started >= settings->backoff_max) {
+        // the last run was stable
+        daemon.backoff_step = 0;
+    }
+    if(settings->max_restarts != 0 && daemon.backoff_step >= settings->max_restarts) {
+        print("daemon ", daemon.name, " restarted too many times");
+        set_state(daemon, State::Fail);
+        reschedule = true;
+        return;
+    }
+
+    // exponential backoff with jitter in [delay / 2, delay], so that daemons failing together do not restart together
+    const auto shift = std::min(daemon.backoff_step, 30u);
+    const auto delay = std::min<std::chrono::milliseconds::rep>(settings->backoff_initial.count() << shift, settings->backoff_max.count());
+    auto       range = std::uniform_int_distribution<std::chrono::milliseconds::rep>(delay / 2, delay);
+    daemon.backoff_step += 1;
+    daemon.restarts += 1;
+    set_state(daemon, State::Backoff);
+    add_timer(daemon, std::chrono::milliseconds(range(random)));
+}
+
+auto DaemonFS::has_dependency_cycle(const Daemon& daemon) -> bool {
+    // only cycles through this daemon, other cycles are found when their members are brought up
+    auto stack   = std::vector<const Daemon*>{&daemon};
+    auto visited = std::unordered_set<const Daemon*>();
+    while(!stack.empty()) {
+        const auto current = stack.back();
+        stack.pop_back();
+        for(const auto& name : current->settings.load()->depends) {
+            const auto dep = find_daemon(name);
+            if(dep == &daemon) {
+                return true;
+            }
+            if(dep != nullptr && visited.insert(dep).second) {
+                stack.push_back(dep);
+            }
+        }
+    }
+    return false;
+}
+
+auto DaemonFS::schedule() -> void {
+    // a daemon which is ready immediately can unblock others, so repeat until nothing changes
+    while(reschedule) {
+        reschedule = false;
+        for(auto i = size_t(0); i < waiting.size();) {
+            auto& daemon    = *waiting[i];
+            auto  satisfied = true;
+            auto  failed    = false;
+            for(const auto& name : daemon.settings.load()->depends) {
+                const auto dep = find_daemon(name);
+                if(dep == nullptr || dep->state != State::Up) {
+                    satisfied = false;
+                }
+                // a dependency which was already failed when the daemon began to wait may still be brought up
+                if(dep != nullptr && dep->state == State::Fail && dep->state_changed >= daemon.state_changed) {
+                    failed = true;
+                }
+            }
+            if(!satisfied && !failed) {
+                i += 1;
+                continue;
+            }
+            waiting[i] = waiting.back();
+            waiting.pop_back();
+            if(failed) {
+                print("dependency of daemon ", daemon.name, " failed");
+                set_state(daemon, State::Fail);
+                reschedule = true;
+                continue;
+            }
+            start_daemon(daemon);
+        }
+    }
+}
+
+auto DaemonFS::reap_daemon(Daemon& daemon) -> void {
     auto       status = int();
-    const auto joined = waitpid(-1, &status, WNOHANG);
+    auto       usage  = rusage();
+    const auto joined = wait4(daemon.pid, &status, WNOHANG, &usage);
+    if(joined == 0) {
+        return;
+    }
     if(joined == -1) {
-        bail("waitpid() error: ", strerror(errno));
-    } else if(joined == 0) {
-        bail("no process available for wait");
+        // status and usage were not filled
+        line_warn("wait4() error: ", strerror(errno));
+        return;
+    }
+    on_daemon_exit(daemon, status, usage);
+}
+
+auto DaemonFS::reap_children() -> void {
+    // signals coalesce, so reap until no child is left
+    while(true) {
+        auto       status = int();
+        auto       usage  = rusage();
+        const auto joined = wait4(-1, &status, WNOHANG, &usage);
+        if(joined == 0 || (joined == -1 && errno == ECHILD)) {
+            return;
+        }
+        if(joined == -1) {
+            bail("wait4() error: ", strerror(errno));
+        }
+        const auto daemon = daemons.find_by_pid(joined);
+        if(daemon == nullptr) {
+            line_warn("pid ", joined, " is not known daemon");
+            continue;
+        }
+        on_daemon_exit(*daemon, status, usage);
     }
-    auto daemon_it = std::ranges::find_if(daemons, [joined](auto& d) { return d->pid == joined; });
-    ensure(daemon_it != daemons.end(), "pid ", joined, " is not known daemon");
-    auto& daemon = *daemon_it->get();
+}
+
+auto DaemonFS::open_sigchld_fd() -> bool {
+    ensure(sig::block(SIGCHLD, true));
+    auto set = sig::empty_siget();
+    ensure(sigaddset(&set, SIGCHLD) == 0);
+    sigchld_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    ensure(sigchld_fd >= 0, strerror(errno));
+    auto event = epoll_event{.events = EPOLLIN, .data = {.ptr = &sigchld_fd}};
+    ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, sigchld_fd, &event) == 0, strerror(errno));
+    return true;
+}
+
+auto DaemonFS::on_daemon_exit(Daemon& daemon, const int status, const rusage& usage) -> void {
+    daemons.unbind_pid(daemon);
+    daemon.finish_usage(usage);
+    live -= 1;
     if(WIFEXITED(status)) {
         print("daemon ", daemon.name, " exitted with code = ", WEXITSTATUS(status));
     } else {
         print("daemon ", daemon.name, " terminated with signal = ", WTERMSIG(status));
     }
 
+    drain_pipe(daemon, false);
+    drain_pipe(daemon, true);
     ensure(remove_fd_from_epollfds(daemon.stdout_fd));
     ensure(remove_fd_from_epollfds(daemon.stderr_fd));
+    ensure(remove_fd_from_epollfds(daemon.notify_fd));
+    ensure(remove_fd_from_epollfds(daemon.pidfd));
+    cancel_timer(daemon);
+    if(daemon.cgroup_fd != -1) {
+        // leftovers, such as processes daemonized by the leader, do not outlive it nor join the next run
+        cgroup::kill(daemon.cgroup_fd);
+    }
 
     if(daemon.oneshot || daemon.state == State::WantDown) {
-        daemon.set_state(State::Down);
+        set_state(daemon, State::Down);
         return;
     }
 
-    const auto elapsed = std::chrono::system_clock::now() - daemon.state_changed;
-    const auto fail    = std::chrono::duration_cast<std::chrono::seconds>(elapsed).count() < 5;
+    // without restarts, an early exit of the first run is reported as a launch failure
+    // daemons which are restarted go through backoff instead, crashes at boot are what it is for
+    const auto elapsed = std::chrono::system_clock::now() - daemon.started;
+    const auto never   = daemon.settings.load()->restart == RestartPolicy::Never;
+    const auto fail    = never && daemon.restarts == 0 && std::chrono::duration_cast<std::chrono::seconds>(elapsed).count() < 5;
     if(fail) {
         print("daemon ", daemon.name, " failed to launch");
-        daemon.set_state(State::Fail);
-    } else {
-        print("restarting daemon ", daemon.name);
-        ensure(start_daemon(daemon));
+        set_state(daemon, State::Fail);
+        reschedule = true;
+        return;
+    }
+    restart_daemon(daemon, !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+}
+
+auto DaemonFS::drain_pipe(Daemon& daemon, const bool is_stderr) -> void {
+    const auto fd  = is_stderr ? daemon.stderr_fd : daemon.stdout_fd;
+    auto&      buf = is_stderr ? daemon.stderr_buf : daemon.stdout_buf;
+    if(fd == -1) {
+        return;
+    }
+    auto&      spool = is_stderr ? daemon.stderr_spool : daemon.stdout_spool;
+    const auto begin = buf.end();
+    // the status shows how much of the ring is used, which stops changing once the ring is full
+    const auto filling = begin - buf.start() < buf.capacity();
+    // while spooling, a read takes at most half of the ring, or one byte of a smaller one, like write_from_fd()
+    // with what is pending spooled first, nothing the ring holds is overwritten before it is on disk
+    // a ring of size 0 holds nothing, so its output is neither kept nor spooled
+    const auto limit = std::max(buf.capacity() / 2, size_t(1));
+    while(true) {
+        if(spool.is_open() && buf.capacity() > 0 && spool.pending(buf) > buf.capacity() - limit) {
+            spool.append(buf);
+        }
+        auto len      = ssize_t();
+        auto capacity = size_t();
+        if(!verbose && buf.capacity() > 1) {
+            // straight into the ring, readers are not blocked meanwhile
+            len      = buf.write_from_fd(fd);
+            capacity = limit;
+        } else {
+            capacity = spool.is_open() && buf.capacity() > 0 ? std::min(drain_buf.size(), limit) : drain_buf.size();
+            len      = ::read(fd, drain_buf.data(), capacity);
+            if(len > 0) {
+                if(verbose) {
+                    print(daemon.name, ": ", std::string_view{drain_buf.data(), size_t(len)});
+                }
+                buf.write({drain_buf.data(), size_t(len)});
+            }
+        }
+        if((len < 0 && errno == EAGAIN) || len == 0) {
+            break;
+        }
+        if(len < 0) {
+            line_warn("read() failed: ", strerror(errno));
+            break;
+        }
+        if(size_t(len) < capacity) {
+            // short read, pipe is empty
+            // more data triggers another epoll event, so no need to spend a read() on EAGAIN
+            break;
+        }
+    }
+    if(buf.end() != begin) {
+        daemon.wake_followers(is_stderr ? FileKind::Stderr : FileKind::Stdout);
+        if(filling) {
+            status_changed();
+        }
     }
 }
 
@@ -119,119 +788,214 @@ auto DaemonFS::remove_fd_from_epollfds(int& fd) -> bool {
     return true;
 }
 
-auto DaemonFS::process_command(const Commands::GetAttr& args) -> int {
-    const auto path = std::string_view(args.path);
-    if(path == "/") {
-        dir_attr(*args.stbuf);
-        set_timestamp(*args.stbuf, created);
-        return 0;
-    }
-    const auto elms = split(path, "/");
-    ensure_e(elms.size() == 1 || elms.size() == 2, -EINVAL);
-    const auto name   = elms[0];
-    const auto daemon = find_daemon(name);
-    if(!daemon) {
-        // intentionally not a ensure_e
-        return -ENOENT;
-    }
-    if(elms.size() == 1) {
-        dir_attr(*args.stbuf);
-        set_timestamp(*args.stbuf, daemon->created);
-        return 0;
-    }
-    return daemon->getattr(elms[1], *args.stbuf);
-}
-
 auto DaemonFS::process_command(const Commands::MakeDir& args) -> int {
-    const auto path = std::string_view(args.path);
-    const auto elms = split(path, "/");
-    ensure_e(elms.size() == 1, -EINVAL);
-    const auto name   = elms[0];
-    const auto daemon = find_daemon(name);
-    ensure_e(!daemon, -EEXIST);
-    daemons.emplace_back(new Daemon{.name = std::string(name)});
-    return 0;
+    ensure_e(args.parent == ino::root, -EINVAL);
+    ensure_e(!find_daemon(args.name), -EEXIST);
+    const auto created            = std::shared_ptr<Daemon>(new Daemon{.name = std::string(args.name)});
+    created->stdout_buf.use_memfd = zero_copy;
+    created->stderr_buf.use_memfd = zero_copy;
+    const auto daemon             = daemons.insert(created);
+    ensure_e(daemon, -ENOSPC);
+    open_spools(*daemon);
+    status_changed();
+    return fill_entry(*daemon, FileKind::Dir, *args.entry);
 }
 
 auto DaemonFS::process_command(const Commands::RemoveDir& args) -> int {
-    const auto path = std::string_view(args.path);
-    const auto elms = split(path, "/");
-    ensure_e(elms.size() == 1, -EINVAL);
-    const auto name      = elms[0];
-    const auto daemon_it = std::ranges::find_if(daemons, [name](auto& d) { return d->name == name; });
-    ensure_e(daemon_it != daemons.end(), -ENOENT);
-    const auto daemon = *(*daemon_it);
-    ensure_e(daemon.state != State::Up && daemon.state != State::WantDown, -EBUSY);
-    daemons.erase(daemon_it);
+    ensure_e(args.parent == ino::root, -EINVAL);
+    const auto daemon = find_daemon(args.name);
+    ensure_e(daemon, -ENOENT);
+    ensure_e(!is_running(daemon->state), -EBUSY);
+    std::erase(waiting, daemon);
+    cancel_timer(*daemon);
+    if(daemon->cgroup_fd != -1) {
+        // fails with EBUSY while killed leftovers are still exiting, the cgroup is reused if the name comes back
+        close(daemon->cgroup_fd);
+        cgroup::remove(cgroup_root, daemon->name.data());
+    }
+    // the segments stay, a daemon created again under the name continues them
+    daemon->stdout_spool.append(daemon->stdout_buf);
+    daemon->stderr_spool.append(daemon->stderr_buf);
+    daemons.erase(*daemon);
+    status_changed();
     return 0;
 }
 
-auto DaemonFS::process_command(const Commands::ReadDir& args) -> int {
-    const auto path = std::string_view(args.path);
-    if(path == "/") {
-        for(const auto& daemon : daemons) {
-            args.filler(args.buf, daemon->name.data(), NULL, 0, fuse_fill_dir_flags(0));
-        }
+auto DaemonFS::process_command(const Commands::Truncate& args) -> int {
+    if(args.ino == ino::make_root(ino::RootFile::Control)) {
+        // O_TRUNC of shell redirections
         return 0;
     }
-    const auto elms = split(path, "/");
-    ensure_e(elms.size() == 1, -EINVAL);
-    const auto name   = elms[0];
-    const auto daemon = find_daemon(name);
+    const auto daemon = find_daemon_by_ino(args.ino);
     ensure_e(daemon, -ENOENT);
-    return daemon->readdir([&args](const char* const name, const Stat& stat) {
-        return args.filler(args.buf, name, &stat, 0, fuse_fill_dir_flags(0)) == 0;
-    });
-}
-
-auto DaemonFS::process_command(const Commands::Truncate& args) -> int {
-    const auto [daemon, file] = find_daemon_and_filename(args.path);
-    ensure(daemon, -ENOENT);
+    // shrinking keeps only the newest bytes, so the rest goes to disk first
+    const auto file = ino::kind_of(args.ino);
+    if(file == FileKind::Stdout) {
+        daemon->stdout_spool.append(daemon->stdout_buf);
+    } else if(file == FileKind::Stderr) {
+        daemon->stderr_spool.append(daemon->stderr_buf);
+    }
+    // ring capacity
+    status_changed();
     return daemon->truncate(file, args.offset);
 }
 
-auto DaemonFS::process_command(const Commands::Read& args) -> int {
-    const auto [daemon, file] = find_daemon_and_filename(args.path);
-    ensure(daemon, -ENOENT);
-    return daemon->read(file, args.offset, args.size, args.buffer);
-}
-
 auto DaemonFS::process_command(const Commands::Write& args) -> int {
-    const auto [daemon, file] = find_daemon_and_filename(args.path);
-    ensure(daemon, -ENOENT);
+    const auto daemon = find_daemon_by_ino(args.ino);
+    ensure_e(daemon, -ENOENT);
+    const auto file = ino::kind_of(args.ino);
 
-    if(file == "state") {
+    if(file == FileKind::State) {
         ensure_e(args.offset == 0, -EINVAL);
-        const auto str = extract_string({args.buffer, args.size});
-        if(str == "up") {
-            ensure_e(daemon->state == State::Down || daemon->state == State::Fail, -EINVAL);
-            ensure_e(start_daemon(*daemon), -EIO);
-        } else if(str == "down") {
-            ensure_e(daemon->state == State::Up, -EINVAL);
-            daemon->set_state(State::WantDown);
-            ensure_e(kill(daemon->pid, SIGTERM) == 0, -EIO);
-        } else {
-            return -EINVAL;
+        const auto ret = change_state(*daemon, extract_string({args.buffer, args.size}));
+        return ret < 0 ? ret : int(args.size);
+    }
+
+    if(is_cgroup_limit(file)) {
+        // applied at once, the kernel has the last word on the value
+        ensure_e(cgroup_root != -1, -EOPNOTSUPP);
+        ensure_e(daemon->state != State::Init && args.offset == 0, -EINVAL);
+        ensure_e(open_cgroup(*daemon), -EIO);
+        const auto ret = cgroup::write(daemon->cgroup_fd, file_kind_name(file), extract_string({args.buffer, args.size}));
+        ensure_e(ret == 0, ret);
+    }
+
+    const auto ret = daemon->write(file, args.offset, args.size, args.buffer);
+    if(file == FileKind::Args && ret >= 0) {
+        // through here so that /.status, /.events and the kernel cache see it
+        set_state(*daemon, State::Down);
+    }
+    if(file == FileKind::Depends && ret > 0) {
+        reschedule = true;
+    }
+    return ret;
+}
+
+auto DaemonFS::change_state(Daemon& daemon, const std::string_view command) -> int {
+    if(command == "up") {
+        ensure_e(daemon.state == State::Down || daemon.state == State::Fail, -EINVAL);
+        daemon.restarts     = 0;
+        daemon.backoff_step = 0;
+        if(daemon.settings.load()->depends.empty()) {
+            ensure_e(start_daemon(daemon), -EIO);
+            return 0;
+        }
+        ensure_e(!has_dependency_cycle(daemon), -ELOOP);
+        // started by schedule() at the end of this loop iteration, or later when the dependencies are up
+        set_state(daemon, State::Wait);
+        waiting.push_back(&daemon);
+        reschedule = true;
+    } else if(command == "down") {
+        if(daemon.state == State::Wait || daemon.state == State::Backoff) {
+            // no process yet
+            std::erase(waiting, &daemon);
+            cancel_timer(daemon);
+            set_state(daemon, State::Down);
+            return 0;
         }
-        return args.size;
+        ensure_e(daemon.state == State::Up || daemon.state == State::Start, -EINVAL);
+        stop_daemon(daemon);
+    } else {
+        return -EINVAL;
     }
+    return 0;
+}
 
-    return daemon->write(file, args.offset, args.size, args.buffer);
+auto DaemonFS::process_command(const Commands::Control& args) -> int {
+    // "VERB SELECTOR..." per line, a selector is a daemon name or an fnmatch() pattern
+    // results are "VERB NAME ok" or "VERB NAME EINVAL" per daemon, and "VERB SELECTOR ENOENT" for a selector matching nothing
+    auto& results = *args.results;
+    auto  targets = std::vector<Daemon*>();
+    for(const auto line : split(std::string_view(args.buffer, args.size), "\n")) {
+        const auto elms = split(line, " ");
+        if(elms.empty() || elms[0].empty()) {
+            continue;
+        }
+        const auto verb = elms[0];
+        for(auto i = size_t(1); i < elms.size(); i += 1) {
+            const auto selector = elms[i];
+            if(selector.empty()) {
+                continue;
+            }
+            targets.clear();
+            if(selector.find_first_of("*?[") == std::string_view::npos) {
+                if(const auto daemon = find_daemon(selector); daemon != nullptr) {
+                    targets.push_back(daemon);
+                }
+            } else {
+                const auto pattern = std::string(selector);
+                daemons.for_each([&pattern, &targets](Daemon& daemon) {
+                    if(fnmatch(pattern.data(), daemon.name.data(), 0) == 0) {
+                        targets.push_back(&daemon);
+                    }
+                });
+            }
+            if(targets.empty()) {
+                results += build_string(verb, " ", selector, " ENOENT\n");
+                continue;
+            }
+            for(const auto daemon : targets) {
+                const auto ret = change_state(*daemon, verb);
+                results += build_string(verb, " ", daemon->name, " ", ret == 0 ? "ok" : strerrorname_np(-ret), "\n");
+            }
+        }
+    }
+    return args.size;
 }
 
 auto DaemonFS::process_command(const Commands::Quit& /*args*/) -> int {
+    // every daemon is stopped at once, the loop ends when the last one is reaped
+    shutting_down = true;
+    waiting.clear();
+    daemons.for_each([this](Daemon& daemon) {
+        if(daemon.state == State::Wait || daemon.state == State::Backoff) {
+            cancel_timer(daemon);
+            set_state(daemon, State::Down);
+        } else if(daemon.state == State::Start || daemon.state == State::Up) {
+            stop_daemon(daemon);
+        }
+    });
+    return 0;
+}
+
+auto DaemonFS::process_command(const Commands::Upgrade& /*args*/) -> int {
+    ensure_e(save_snapshot(true), -EIO);
+    // the rings saved in the snapshot are not spooled again
+    flush_spools();
+    // inherited by the exec'ed daemonfs
+    daemons.for_each([](const Daemon& daemon) {
+        for(const auto fd : {daemon.stdout_fd, daemon.stderr_fd, daemon.notify_fd}) {
+            if(fd != -1) {
+                fcntl(fd, F_SETFD, 0);
+            }
+        }
+    });
     running = false;
     return 0;
 }
 
+auto DaemonFS::process_command(const Commands::Bootstrap& args) -> int {
+    const auto daemon = daemons.insert(std::shared_ptr<Daemon>(new Daemon{
+        .name    = "bootstrap",
+        .args    = {std::string(args.path)},
+        .oneshot = true,
+    }));
+    ensure_e(daemon, -ENOSPC);
+    open_spools(*daemon);
+    set_state(*daemon, State::Down);
+    ensure_e(start_daemon(*daemon), -EIO);
+    return 0;
+}
+
 auto DaemonFS::process_requests() -> void {
-    for(auto& request : requests.swap()) {
+    requests.drain([this](Request& request) {
+        queued.fetch_sub(1, std::memory_order_relaxed);
         unwrap(result, request.command.apply([this](auto& command) -> int {
             return process_command(command);
         }));
-        request.notify->result = result;
-        request.notify->event.notify();
-    }
+        request.result = result;
+        request.done.notify();
+    });
 }
 
 auto DaemonFS::init() -> bool {
@@ -242,77 +1006,438 @@ auto DaemonFS::init() -> bool {
     ensure(epollfd >= 0, strerror(errno));
     auto event = epoll_event{.events = EPOLLIN, .data = {.ptr = &requests}};
     ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, requests_event, &event) == 0, strerror(errno));
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ensure(timer_fd >= 0, strerror(errno));
+    event.data.ptr = &timer_fd;
+    ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, timer_fd, &event) == 0, strerror(errno));
+    events.resize(events_size);
+    timers.arm(sampler, std::chrono::duration_cast<std::chrono::milliseconds>(sample_interval).count());
+    arm_timer();
+
+    if(cgroup_path != nullptr) {
+        cgroup_root = ::open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        ensure(cgroup_root >= 0, "failed to open cgroup directory: ", strerror(errno));
+        cgroup::enable_controllers(cgroup_root);
+    }
+    if(log_path != nullptr) {
+        log_root = ::open(log_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        ensure(log_root >= 0, "failed to open log directory: ", strerror(errno));
+    }
+
+    // children are reaped through pidfd, fall back to signalfd on kernels older than 5.3
+    if(const auto fd = pidfd_open(getpid()); fd >= 0) {
+        close(fd);
+    } else {
+        warn("pidfd_open() failed, using signalfd instead: ", strerror(errno));
+        // must be blocked before other threads are spawned
+        ensure(open_sigchld_fd());
+    }
+
+    if(snapshot_path != nullptr) {
+        // same as SIGCHLD, SIGUSR2 goes to the worker only
+        ensure(sig::block(SIGUSR2, true));
+        auto set = sig::empty_siget();
+        ensure(sigaddset(&set, SIGUSR2) == 0);
+        upgrade_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+        ensure(upgrade_fd >= 0, strerror(errno));
+        event.data.ptr = &upgrade_fd;
+        ensure(epoll_ctl(epollfd, EPOLL_CTL_ADD, upgrade_fd, &event) == 0, strerror(errno));
+        ensure(load_snapshot());
+    }
     return true;
 }
 
 auto DaemonFS::run() -> bool {
-    ensure(sig::block(SIGCHLD, true));
-    ensure(sig::set_handler(SIGCHLD, sigchild_handler));
-
     running = true;
 
-    auto event     = epoll_event();
-    auto empty_set = sig::empty_siget();
+    auto events = std::array<epoll_event, 64>();
+    auto exited = std::vector<Daemon*>();
 loop:
     if(!running) {
         return true;
     }
 
-    const auto poll = epoll_pwait(epollfd, &event, 1, -1, &empty_set);
-    if(poll == -1 && errno != EINTR) {
-        warn("epoll_pwait error: ", strerror(errno));
+    const auto count = epoll_wait(epollfd, events.data(), events.size(), -1);
+    if(count == -1) {
+        if(errno != EINTR) {
+            warn("epoll_wait error: ", strerror(errno));
+        }
         goto loop;
     }
-    if(poll == -1) {
-        goto wait;
-    }
-    if(event.data.ptr == &requests) {
-        if(event.events & EPOLLIN) {
-            auto buf = uint64_t();
-            read(requests_event, &buf, sizeof(buf));
-            process_requests();
+    wakeups.store(wakeups.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    // pipes are handled first so that exits do not lose trailing output,
+    // and requests last so that rmdir can not free a daemon still referenced by this batch
+    auto requests_ready = false;
+    auto sigchld_ready  = false;
+    auto timer_ready    = false;
+    exited.clear();
+    for(const auto& event : std::span(events.data(), count)) {
+        if(event.data.ptr == &requests) {
+            requests_ready = true;
+            continue;
         }
-    } else {
-        const auto ptr       = (uintptr_t)event.data.ptr;
-        auto&      daemon    = *std::bit_cast<Daemon*>(ptr & ~uintptr_t(1));
-        const auto is_stderr = (ptr & 1) == 1;
-        auto&      fd        = is_stderr ? daemon.stderr_fd : daemon.stdout_fd;
+        if(event.data.ptr == &sigchld_fd) {
+            sigchld_ready = true;
+            continue;
+        }
+        if(event.data.ptr == &timer_fd) {
+            timer_ready = true;
+            continue;
+        }
+        if(event.data.ptr == &upgrade_fd) {
+            request_upgrade();
+            continue;
+        }
+        const auto ptr    = std::bit_cast<uintptr_t>(event.data.ptr);
+        auto&      daemon = *std::bit_cast<Daemon*>(ptr & ~uintptr_t(DaemonEvent::Mask));
+        if((ptr & DaemonEvent::Mask) == DaemonEvent::Exit) {
+            exited.push_back(&daemon);
+            continue;
+        }
+        if((ptr & DaemonEvent::Mask) == DaemonEvent::Notify) {
+            read_notify(daemon);
+            continue;
+        }
+        const auto is_stderr = (ptr & DaemonEvent::Mask) == DaemonEvent::Stderr;
         if(event.events & EPOLLIN) {
-            auto buf = std::array<char, 256>();
-            while(true) {
-                const auto len = read(fd, buf.data(), buf.size());
-                if((len < 0 && errno == EAGAIN) || len == 0) {
-                    break;
-                }
-                if(len < 0) {
-                    line_warn("read() failed: ", strerror(errno));
-                    break;
-                }
-                if(verbose) {
-                    print(daemon.name, ": ", std::string_view{buf.data(), size_t(len)});
-                }
-                (is_stderr ? daemon.stderr_buf : daemon.stdout_buf).write({buf.data(), size_t(len)});
-            }
+            drain_pipe(daemon, is_stderr);
         }
         if(event.events & EPOLLHUP) {
             // daemon closed other end of the pipe
-            ensure(remove_fd_from_epollfds(fd));
+            ensure(remove_fd_from_epollfds(is_stderr ? daemon.stderr_fd : daemon.stdout_fd));
+        }
+    }
+    for(const auto daemon : exited) {
+        reap_daemon(*daemon);
+    }
+    if(sigchld_ready) {
+        auto info = signalfd_siginfo();
+        while(::read(sigchld_fd, &info, sizeof(info)) == sizeof(info)) {
+        }
+        reap_children();
+    }
+    if(timer_ready) {
+        fire_timers();
+    }
+    if(requests_ready) {
+        // clear the eventfd before taking the queue, a request pushed after the drain makes it readable again
+        auto buf = uint64_t();
+        ::read(requests_event, &buf, sizeof(buf));
+        process_requests();
+        if(snapshot_path != nullptr && !snapshotter.is_armed()) {
+            add_timer(snapshotter, snapshot_delay);
         }
     }
-wait:
-    for(auto l = sigchild_count.exchange(0); l > 0; l -= 1) {
-        wait_daemon_process();
+    // nothing is started after an upgrade saved the snapshot
+    if(reschedule && running) {
+        schedule();
+    }
+    if(shutting_down && live == 0) {
+        running = false;
+        save_snapshot(false);
+        flush_spools();
     }
     goto loop;
 }
 
-auto DaemonFS::add_oneshot_daemon(std::string name, std::string path) -> bool {
-    auto& daemon = daemons.emplace_back(new Daemon{
-        .name    = std::move(name),
-        .args    = {std::move(path)},
-        .oneshot = true,
+auto DaemonFS::format_metrics() const -> std::string {
+    auto out = std::string();
+    metrics::format(out);
+    out += build_string("# TYPE daemonfs_queued_requests gauge\n",
+                        "daemonfs_queued_requests ", queued.load(std::memory_order_relaxed), "\n",
+                        "# TYPE daemonfs_worker_wakeups_total counter\n",
+                        "daemonfs_worker_wakeups_total ", wakeups.load(std::memory_order_relaxed), "\n");
+
+    // end of a ring is the total bytes written to it, start is how many of them left the ring
+    // evicted bytes may or may not have been read, readers keep no shared cursor to tell
+    auto ingested = std::string("# TYPE daemonfs_log_bytes_total counter\n");
+    auto evicted  = std::string("# TYPE daemonfs_log_evicted_bytes_total counter\n");
+    daemons.for_each([&ingested, &evicted](const Daemon& daemon) {
+        const auto name = metrics::label(daemon.name);
+        for(const auto is_stdout : {true, false}) {
+            const auto& ring   = is_stdout ? daemon.stdout_buf : daemon.stderr_buf;
+            const auto  labels = build_string("{daemon=", name, ",stream=\"", is_stdout ? "stdout" : "stderr", "\"} ");
+            ingested += build_string("daemonfs_log_bytes_total", labels, ring.end(), "\n");
+            evicted += build_string("daemonfs_log_evicted_bytes_total", labels, ring.start(), "\n");
+        }
     });
-    daemon->set_state(State::Down);
-    ensure(start_daemon(*daemon));
-    return true;
+    return out + ingested + evicted;
+}
+
+auto DaemonFS::control(const char* const buffer, const size_t size, Reader& reader) -> int {
+    auto       results = std::string();
+    const auto ret     = remote_command<Commands::Control>(buffer, size, &results);
+    if(ret >= 0) {
+        reader.snapshot = std::make_shared<const std::string>(std::move(results));
+        reader.position.store(0, std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+auto DaemonFS::status_changed() -> void {
+    status_version.fetch_add(1, std::memory_order_release);
+}
+
+auto DaemonFS::format_status(const bool binary) const -> std::string {
+    auto out   = std::string();
+    auto count = uint32_t(0);
+    if(binary) {
+        out.resize(sizeof(StatusHeader));
+    }
+    daemons.for_each([binary, &out, &count](const Daemon& daemon) {
+        const auto status  = daemon.status.load();
+        const auto ms      = std::chrono::duration_cast<std::chrono::milliseconds>(status.state_changed.time_since_epoch()).count();
+        const auto pid     = is_running(status.state) ? status.pid : 0;
+        const auto out_len = daemon.stdout_buf.end() - daemon.stdout_buf.start();
+        const auto err_len = daemon.stderr_buf.end() - daemon.stderr_buf.start();
+        count += 1;
+        if(!binary) {
+            // "STATE PID CHANGED_MS RESTARTS STDOUT_USED/SIZE STDERR_USED/SIZE NAME", the name goes last since it may contain spaces
+            out += build_string(state_name(status.state), " ", pid, " ", ms, " ", status.restarts, " ",
+                                out_len, "/", daemon.stdout_buf.capacity(), " ", err_len, "/", daemon.stderr_buf.capacity(), " ", daemon.name, "\n");
+            return;
+        }
+        const auto record = StatusRecord{
+            .state_changed_ms = ms,
+            .stdout_used      = out_len,
+            .stdout_capacity  = daemon.stdout_buf.capacity(),
+            .stderr_used      = err_len,
+            .stderr_capacity  = daemon.stderr_buf.capacity(),
+            .pid              = pid,
+            .restarts         = status.restarts,
+            .name_size        = uint16_t(daemon.name.size()),
+            .state            = uint8_t(status.state),
+            .reserved         = {},
+        };
+        out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        out += daemon.name;
+        out.resize((out.size() + 7) & ~size_t(7));
+    });
+    if(binary) {
+        const auto header = StatusHeader{.magic = status_magic, .count = count, .record_size = sizeof(StatusRecord)};
+        std::memcpy(out.data(), &header, sizeof(header));
+    }
+    return out;
+}
+
+auto DaemonFS::load_status(const bool binary) const -> std::shared_ptr<const std::string> {
+    auto&      slot    = status_cache[binary];
+    const auto version = status_version.load(std::memory_order_acquire);
+    auto       cache   = slot.load();
+    if(!cache || cache->version != version) {
+        // concurrent readers may both build it, the later store wins
+        // a change during the build leaves an older version in the cache, which the next read replaces
+        cache = std::make_shared<const StatusCache>(version, format_status(binary));
+        slot.store(cache);
+    }
+    return std::shared_ptr<const std::string>(cache, &cache->data);
+}
+
+auto DaemonFS::lookup(const fuse_ino_t parent, const char* const name, fuse_entry_param& entry) const -> int {
+    if(parent == ino::root) {
+        for(auto i = size_t(0); i < root_file_str.size(); i += 1) {
+            if(std::string_view(name) == root_file_str[i]) {
+                root_file_attr(ino::RootFile(i), created, entry.attr);
+                entry.ino = entry.attr.st_ino;
+                return 0;
+            }
+        }
+        const auto daemon = daemons.lookup(name);
+        if(!daemon) {
+            // intentionally not a ensure_e
+            return -ENOENT;
+        }
+        return fill_entry(*daemon, FileKind::Dir, entry);
+    }
+    const auto daemon = load_daemon_by_ino(parent);
+    ensure_e(daemon && ino::kind_of(parent) == FileKind::Dir, -ENOENT);
+    const auto kind = file_kind_from_name(name);
+    if(!kind) {
+        return -ENOENT;
+    }
+    return fill_entry(*daemon, *kind, entry);
+}
+
+auto DaemonFS::getattr(const fuse_ino_t ino, Stat& stbuf, double& timeout) const -> int {
+    timeout = cache_timeout;
+    if(ino == ino::root) {
+        dir_attr(stbuf);
+        set_timestamp(stbuf, created);
+        stbuf.st_ino = ino;
+        return 0;
+    }
+    if(ino::is_root_file(ino)) {
+        root_file_attr(ino::root_file_of(ino), created, stbuf);
+        return 0;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    if(!daemon) {
+        // intentionally not a ensure_e
+        return -ENOENT;
+    }
+    return fill_attr(*daemon, ino::kind_of(ino), stbuf);
+}
+
+auto DaemonFS::readdir(const fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t offset, std::vector<char>& buf) const -> int {
+    auto dir = DirBuffer{req, buf, size};
+    if(ino == ino::root) {
+        // offset: 1 = ".", 2 = "..", file + 3 = root file, slot + files + 3 = daemon
+        constexpr auto files = off_t(ino::RootFile::Limit);
+        if(offset < 1 && !dir.add(".", ino::root, S_IFDIR, 1)) {
+            return 0;
+        }
+        if(offset < 2 && !dir.add("..", ino::root, S_IFDIR, 2)) {
+            return 0;
+        }
+        for(auto file = std::max<off_t>(offset, 2) - 2; file < files; file += 1) {
+            if(!dir.add(root_file_str[file], ino::make_root(ino::RootFile(file)), S_IFREG, file + 3)) {
+                return 0;
+            }
+        }
+        for(auto slot = uint32_t(std::max<off_t>(offset, files + 2) - files - 2), count = daemons.size(); slot < count; slot += 1) {
+            const auto daemon = daemons.load(slot);
+            if(!daemon) {
+                continue;
+            }
+            if(!dir.add(daemon->name.data(), ino::make(slot, FileKind::Dir), S_IFDIR, slot + files + 3)) {
+                break;
+            }
+        }
+        return 0;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    ensure_e(daemon && ino::kind_of(ino) == FileKind::Dir, -ENOENT);
+    // offset: 1 = ".", 2 = "..", kind + 2 = file
+    if(offset < 1 && !dir.add(".", ino, S_IFDIR, 1)) {
+        return 0;
+    }
+    if(offset < 2 && !dir.add("..", ino::root, S_IFDIR, 2)) {
+        return 0;
+    }
+    return daemon->readdir([&dir, &daemon, offset](const FileKind kind, const Stat& stat) {
+        const auto next = off_t(kind) + 2;
+        if(next <= offset) {
+            return true;
+        }
+        return dir.add(file_kind_name(kind), ino::make(daemon->slot, kind), stat.st_mode, next);
+    });
+}
+
+auto DaemonFS::read(const fuse_ino_t ino, Reader* const reader, char* const buffer, const size_t offset, const size_t size) const -> int {
+    if(ino == ino::make_root(ino::RootFile::Metrics)) {
+        // generated by the read at offset 0, the rest of a scrape spanning many reads sees the same text
+        ensure_e(reader != nullptr, -EINVAL);
+        if(offset == 0 || !reader->snapshot) {
+            reader->snapshot = std::make_shared<const std::string>(format_metrics());
+        }
+        return copy_range(*reader->snapshot, offset, size, buffer);
+    }
+    if(ino == ino::make_root(ino::RootFile::Status) || ino == ino::make_root(ino::RootFile::StatusBin)) {
+        ensure_e(reader != nullptr, -EINVAL);
+        if(offset == 0 || !reader->snapshot) {
+            reader->snapshot = load_status(ino == ino::make_root(ino::RootFile::StatusBin));
+        }
+        return copy_range(*reader->snapshot, offset, size, buffer);
+    }
+    if(ino == ino::make_root(ino::RootFile::Control)) {
+        // results of the last write on this open file, consumed by reading
+        ensure_e(reader != nullptr, -EINVAL);
+        if(!reader->snapshot) {
+            return 0;
+        }
+        const auto len = copy_range(*reader->snapshot, reader->position.load(std::memory_order_relaxed), size, buffer);
+        reader->position.fetch_add(len, std::memory_order_relaxed);
+        return len;
+    }
+    if(ino == ino::make_root(ino::RootFile::Events)) {
+        // opened for writing, there is no reader
+        return -EINVAL;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    ensure_e(daemon, -ENOENT);
+    if(reader != nullptr && ino::kind_of(ino) == FileKind::State) {
+        // marks the current state seen, may be one change behind the state read below which only makes poll() wake once more
+        reader->position.store(daemon->status.load().transitions, std::memory_order_relaxed);
+    } else if(reader != nullptr) {
+        return daemon->read_log(ino::kind_of(ino), *reader, size, buffer);
+    }
+    if(ino::kind_of(ino) == FileKind::Stats) {
+        usage_wanted.store(true, std::memory_order_relaxed);
+    }
+    return daemon->read(ino::kind_of(ino), offset, size, buffer);
+}
+
+auto DaemonFS::read_buf(const fuse_ino_t ino, Reader& reader, const size_t size, const ReplyBuf& reply) const -> int {
+    if(ino::is_root_file(ino)) {
+        return -ENOTSUP;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    ensure_e(daemon, -ENOENT);
+    return daemon->read_buf(ino::kind_of(ino), reader, size, reply);
+}
+
+auto DaemonFS::open(const fuse_ino_t ino, const int flags, std::unique_ptr<Reader>& reader) const -> int {
+    if(ino == ino::make_root(ino::RootFile::Control)) {
+        // written and read back through the same open file
+        reader.reset(new Reader());
+        return 0;
+    }
+    if((flags & O_ACCMODE) == O_WRONLY) {
+        return 0;
+    }
+    if(ino == ino::make_root(ino::RootFile::Events)) {
+        // always followed, from the next change on
+        reader.reset(new Reader{.position = events.end(), .follow = true});
+        return 0;
+    }
+    if(ino == ino::make_root(ino::RootFile::Metrics) || ino == ino::make_root(ino::RootFile::Status) || ino == ino::make_root(ino::RootFile::StatusBin)) {
+        // holds the snapshot being read
+        reader.reset(new Reader());
+        return 0;
+    }
+    const auto kind = ino::kind_of(ino);
+    if(!ino::is_daemon(ino) || (kind != FileKind::Stdout && kind != FileKind::Stderr && kind != FileKind::State)) {
+        return 0;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    ensure_e(daemon, -ENOENT);
+    if(kind == FileKind::State) {
+        // for poll(), changes after this are reported
+        reader.reset(new Reader{.position = daemon->status.load().transitions});
+        return 0;
+    }
+    // O_APPEND on a read-only file has no other meaning, so it selects follow mode
+    reader.reset(new Reader{.follow = (flags & O_APPEND) != 0});
+    return daemon->open_reader(kind, *reader);
+}
+
+auto DaemonFS::follow(const fuse_req_t req, const fuse_ino_t ino, Reader& reader, const size_t size, const bool nonblock) const -> int {
+    if(ino == ino::make_root(ino::RootFile::Events)) {
+        event_followers.park(req, reader, size, nonblock, fetch_events());
+        return 0;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    ensure_e(daemon, -ENOENT);
+    return daemon->follow(ino::kind_of(ino), req, reader, size, nonblock);
+}
+
+auto DaemonFS::poll(const fuse_ino_t ino, const Reader* const reader, fuse_pollhandle* const handle, unsigned& revents) const -> int {
+    if(ino == ino::make_root(ino::RootFile::Events) && reader != nullptr) {
+        const auto ready = event_followers.poll(reader, handle, [this, reader]() { return reader->position.load(std::memory_order_relaxed) < events.end(); });
+        revents          = ready ? POLLIN | POLLRDNORM : 0;
+        return 0;
+    }
+    if(ino::is_root_file(ino)) {
+        if(handle != nullptr) {
+            fuse_pollhandle_destroy(handle);
+        }
+        revents = POLLIN | POLLRDNORM;
+        return 0;
+    }
+    const auto daemon = load_daemon_by_ino(ino);
+    ensure_e(daemon, -ENOENT);
+    revents = daemon->poll(ino::kind_of(ino), reader, handle);
+    return 0;
 }
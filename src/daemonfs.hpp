@@ -1,51 +1,42 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
 #include <sys/epoll.h>
 #include <unistd.h>
 
+#include "completion.hpp"
 #include "daemon.hpp"
-#include "util/event.hpp"
+#include "inode.hpp"
+#include "mpsc-queue.hpp"
+#include "registry.hpp"
+#include "timer-wheel.hpp"
 #include "util/variant.hpp"
-#include "util/writers-reader-buffer.hpp"
-
-struct RemoteCommandNotify {
-    Event event;
-    int   result;
-};
 
 struct Commands {
-    struct GetAttr {
-        const char* path;
-        Stat*       stbuf;
-    };
-
     struct MakeDir {
-        const char* path;
+        fuse_ino_t        parent;
+        const char*       name;
+        fuse_entry_param* entry;
     };
 
     struct RemoveDir {
-        const char* path;
-    };
-
-    struct ReadDir {
-        const char*     path;
-        void*           buf;
-        fuse_fill_dir_t filler;
+        fuse_ino_t  parent;
+        const char* name;
     };
 
     struct Truncate {
-        const char* path;
-        off_t       offset;
-    };
-
-    struct Read {
-        const char* path;
-        char*       buffer;
-        size_t      offset;
-        size_t      size;
+        fuse_ino_t ino;
+        off_t      offset;
     };
 
     struct Write {
-        const char* path;
+        fuse_ino_t  ino;
         const char* buffer;
         size_t      offset;
         size_t      size;
@@ -54,14 +45,33 @@ struct Commands {
     struct Quit {
     };
 
-    using Command = Variant<GetAttr, MakeDir, RemoveDir, ReadDir, Truncate, Read, Write, Quit>;
+    // saves the snapshot with the running daemons and stops the worker without stopping them
+    struct Upgrade {
+    };
+
+    // lines written to /.control, executed in one go
+    struct Control {
+        const char*  buffer;
+        size_t       size;
+        std::string* results;
+    };
+
+    // the -b script, started as a oneshot daemon once the filesystem is mounted
+    struct Bootstrap {
+        const char* path;
+    };
+
+    using Command = Variant<MakeDir, RemoveDir, Truncate, Write, Quit, Upgrade, Control, Bootstrap>;
 };
 
 using Command = Commands::Command;
 
+// lives on the stack of the caller until the worker completes it
 struct Request {
-    RemoteCommandNotify* notify;
-    Command              command;
+    Request*   next;
+    Command    command;
+    int        result;
+    Completion done;
 };
 
 class DaemonFS {
@@ -70,34 +80,179 @@ class DaemonFS {
 
     TimePoint created = std::chrono::system_clock::now();
 
-    int                                  epollfd;
-    int                                  requests_event;
-    WritersReaderBuffer<Request>         requests;
-    std::vector<std::unique_ptr<Daemon>> daemons;
-    bool                                 running;
+    int                epollfd;
+    int                requests_event;
+    int                sigchld_fd = -1; // only used when pidfd is not available
+    int                timer_fd;
+    MpscQueue<Request> requests;
+    Registry           daemons;
+    uint32_t           live = 0; // daemons with a process
+    bool               running;
+    bool               shutting_down = false;
+
+    // boot scheduling
+    // daemons in State::Wait are started as soon as every daemon in their depends is up
+    std::vector<Daemon*> waiting;
+    bool                 reschedule = false;
+    std::minstd_rand     random{std::random_device()()};
+
+    // one tick is a millisecond since timers_base
+    // timer_fd is armed for the next event of the wheel, armed_tick is 0 while it is not armed
+    TimerWheel              timers;
+    SteadyPoint             timers_base = std::chrono::steady_clock::now();
+    TimerWheel::Tick        armed_tick  = 0;
+    std::vector<TimerNode*> expired; // of the tick being fired
+
+    // resource usage sampling
+    // every interval, up to batch daemons whose stats were read since their last sample are sampled, round robin
+    constexpr static auto sample_interval = std::chrono::seconds(1);
+    constexpr static auto sample_batch    = 256;
+
+    TimerNode                sampler;
+    uint32_t                 sample_cursor = 0;
+    mutable std::atomic_bool usage_wanted  = false; // any of Daemon::usage_wanted is set
+
+    // directory of cgroup_path, each daemon gets a child cgroup named after it
+    int cgroup_root = -1;
+    // directory of log_path, each daemon gets a child directory named after it
+    int log_root = -1;
+
+    // definitions are saved to snapshot_path shortly after requests change them
+    // SIGUSR2 saves the running daemons too and exec's daemonfs again, which adopts them
+    constexpr static auto snapshot_delay = std::chrono::milliseconds(100);
+
+    TimerNode snapshotter;
+    int       upgrade_fd = -1; // signalfd of SIGUSR2
+
+    // exposed in /.metrics
+    std::atomic_uint32_t queued  = 0; // requests pushed and not taken by the worker yet
+    std::atomic_uint64_t wakeups = 0; // of epoll_wait() in the worker, written by the worker only
+
+    // one line per state change of any daemon, read through /.events
+    constexpr static auto events_size = 64 * 1024;
+
+    MessageBuffer     events;
+    mutable Followers event_followers;
+
+    // /.status and /.status.bin, built by the first read after something shown in them changed
+    struct StatusCache {
+        uint64_t    version;
+        std::string data;
+    };
+
+    std::atomic_uint64_t                                                   status_version = 1; // bumped by the worker
+    mutable std::array<std::atomic<std::shared_ptr<const StatusCache>>, 2> status_cache;       // indexed by binary
+
+    // kernel cache invalidations, sent from their own thread
+    // invalidating an entry locks its directory, which an rmdir waiting for the worker may hold
+    struct Invalidation {
+        fuse_ino_t  ino;
+        const char* name; // entry in the directory ino, or nullptr for the attributes of ino
+    };
+
+    fuse_session*             session = nullptr;
+    std::thread               notifier;
+    std::mutex                notify_lock;
+    std::condition_variable   notify_cond;
+    std::vector<Invalidation> invalidations;
+    bool                      notifier_stop = false;
+
+    // used when pipe output can not be read straight into the ring
+    std::array<char, 64 * 1024> drain_buf;
 
     auto find_daemon(std::string_view name) -> Daemon*;
-    auto find_daemon_and_filename(std::string_view path) -> std::pair<Daemon*, std::string_view>;
+    // Daemon::set_state() which also drops what the kernel cached of the old state
+    auto set_state(Daemon& daemon, State state) -> void;
+    auto fetch_events() const -> Followers::Fetch;
+    auto invalidate(fuse_ino_t ino, const char* name) -> void;
+    auto run_notifier() -> void;
+    auto find_daemon_by_ino(fuse_ino_t ino) -> Daemon*;
+    auto load_daemon_by_ino(fuse_ino_t ino) const -> std::shared_ptr<const Daemon>;
     auto start_daemon(Daemon& daemon) -> bool;
-    auto wait_daemon_process() -> void;
+    auto stop_daemon(Daemon& daemon) -> void;
+    // true if cgroups are disabled
+    auto open_cgroup(Daemon& daemon) -> bool;
+    auto mark_ready(Daemon& daemon) -> void;
+    auto read_notify(Daemon& daemon) -> void;
+    // registers the running process of the daemon to the event loop
+    auto watch_daemon(Daemon& daemon) -> void;
+    auto add_timer(Daemon& daemon, std::chrono::nanoseconds delay) -> void;
+    auto add_timer(TimerNode& node, std::chrono::nanoseconds delay) -> void;
+    auto cancel_timer(Daemon& daemon) -> void;
+    auto arm_timer() -> void;
+    auto fire_timers() -> void;
+    auto restart_daemon(Daemon& daemon, bool failed) -> void;
+    auto has_dependency_cycle(const Daemon& daemon) -> bool;
+    auto schedule() -> void;
+    auto reap_daemon(Daemon& daemon) -> void;
+    auto reap_children() -> void;
+    // blocks SIGCHLD in the calling thread and reaps through a signalfd from then on
+    auto open_sigchld_fd() -> bool;
+    auto on_daemon_exit(Daemon& daemon, int status, const rusage& usage) -> void;
+    auto sample_usages() -> void;
+    auto save_snapshot(bool live) -> bool;
+    auto load_snapshot() -> bool;
+    // takes over a daemon left running by the daemonfs which exec'ed this one
+    auto adopt_daemon(Daemon& daemon) -> void;
+    auto request_upgrade() -> void;
+    auto drain_pipe(Daemon& daemon, bool is_stderr) -> void;
     auto remove_fd_from_epollfds(int& fd) -> bool;
 
-    auto process_command(const Commands::GetAttr& args) -> int;
     auto process_command(const Commands::MakeDir& args) -> int;
     auto process_command(const Commands::RemoveDir& args) -> int;
-    auto process_command(const Commands::ReadDir& args) -> int;
     auto process_command(const Commands::Truncate& args) -> int;
-    auto process_command(const Commands::Read& args) -> int;
     auto process_command(const Commands::Write& args) -> int;
     auto process_command(const Commands::Quit& args) -> int;
+    auto process_command(const Commands::Upgrade& args) -> int;
+    auto process_command(const Commands::Control& args) -> int;
+    auto process_command(const Commands::Bootstrap& args) -> int;
+    // "up" or "down" written to the state file, returns 0 or -errno
+    auto change_state(Daemon& daemon, std::string_view command) -> int;
     auto process_requests() -> void;
+    auto format_metrics() const -> std::string;
+    auto open_spools(Daemon& daemon) -> void;
+    // writes what is pending in every ring, done every sample_interval so that the disk sees batches
+    auto flush_spools() -> void;
+    auto status_changed() -> void;
+    auto format_status(bool binary) const -> std::string;
+    auto load_status(bool binary) const -> std::shared_ptr<const std::string>;
 
   public:
-    bool verbose = true;
+    bool verbose   = true;
+    bool zero_copy = false;
+    // cgroup v2 directory delegated to daemonfs, which must not contain daemonfs itself
+    const char* cgroup_path = nullptr;
+    // output older than the rings is kept in segment files under it, only in memory if null
+    const char* log_path = nullptr;
+    // file of the snapshot, daemons are not persisted if null
+    const char* snapshot_path = nullptr;
+    // set by init() if it adopted running daemons, so the bootstrap script is not run again
+    bool resumed = false;
+    // handed over an exec for an upgrade, only a snapshot carrying it is resumed
+    uint64_t resume_token = 0;
+    // set when the fuse session is ended for an upgrade rather than a shutdown
+    std::atomic_bool upgrading = false;
 
     auto init() -> bool;
     auto run() -> bool;
-    auto add_oneshot_daemon(std::string name, std::string path) -> bool;
+    // between mounting and unmounting the session
+    auto start_notifier(fuse_session* session) -> void;
+    auto stop_notifier() -> void;
+
+    // read-only operations, callable from any thread
+    auto lookup(fuse_ino_t parent, const char* name, fuse_entry_param& entry) const -> int;
+    auto getattr(fuse_ino_t ino, Stat& stbuf, double& timeout) const -> int;
+    auto readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, std::vector<char>& buf) const -> int;
+    // reader is set for stdout and stderr, other files are read by offset
+    auto read(fuse_ino_t ino, Reader* reader, char* buffer, size_t offset, size_t size) const -> int;
+    auto read_buf(fuse_ino_t ino, Reader& reader, size_t size, const ReplyBuf& reply) const -> int;
+    // creates a cursor if the file is stdout or stderr opened for reading, or state, or a root file
+    auto open(fuse_ino_t ino, int flags, std::unique_ptr<Reader>& reader) const -> int;
+    // returns 0 if the request was taken, it is answered later
+    auto follow(fuse_req_t req, fuse_ino_t ino, Reader& reader, size_t size, bool nonblock) const -> int;
+    auto poll(fuse_ino_t ino, const Reader* reader, fuse_pollhandle* handle, unsigned& revents) const -> int;
+    // runs the commands in the worker and keeps the results on the open file for reading
+    auto control(const char* buffer, size_t size, Reader& reader) -> int;
 
     template <class T, class... Args>
     auto remote_command(const Args... args) -> int;
@@ -109,13 +264,16 @@ auto DaemonFS::remote_command(const Args... args) -> int {
         printf("new command %lu\n", Command::index_of<T>);
     }
 
-    auto notify = RemoteCommandNotify();
-    requests.push(Request{.notify = &notify, .command = Command::create<T>(args...)});
-    auto buf = uint64_t(1);
-    write(requests_event, &buf, sizeof(buf));
-    notify.event.wait();
+    auto request = Request{.command = Command::create<T>(args...)};
+    queued.fetch_add(1, std::memory_order_relaxed);
+    if(requests.push(request)) {
+        // the worker has not taken the earlier requests yet if the queue was not empty, so it is going to see this one too
+        auto buf = uint64_t(1);
+        write(requests_event, &buf, sizeof(buf));
+    }
+    request.done.wait();
     if(verbose) {
-        printf("done result = %d %s\n", notify.result, strerror(-notify.result));
+        printf("done result = %d %s\n", request.result, strerror(-request.result));
     }
-    return notify.result;
+    return request.result;
 }
@@ -0,0 +1,174 @@
+#include <cstring>
+
+#include "follow.hpp"
+#include "macros/assert.hpp"
+
+auto read_from(const MessageBuffer& ring, Reader& reader, const std::span<char> buf, const LogSpool* const spool) -> size_t {
+    const auto requested = reader.position.load(std::memory_order_relaxed);
+    auto       position  = requested;
+    auto       copied    = size_t(0);
+    if(spool != nullptr && requested < ring.start()) {
+        copied = spool->read_at(position, buf);
+    }
+    if(copied == 0) {
+        copied = ring.read_at(position, buf);
+    }
+    const auto lost = position - copied - requested;
+    if(lost == 0) {
+        reader.position.store(position, std::memory_order_relaxed);
+        return copied;
+    }
+    // the copied bytes are returned again by the next read
+    reader.position.store(position - copied, std::memory_order_relaxed);
+    // starts with a newline, the lost bytes most likely ended in the middle of a line
+    const auto marker = build_string("\n[daemonfs: skipped ", lost, " bytes]\n");
+    const auto len    = std::min(marker.size(), buf.size());
+    memcpy(buf.data(), marker.data(), len);
+    return len;
+}
+
+std::mutex                                                         Followers::interruptible_lock;
+std::unordered_map<fuse_req_t, std::shared_ptr<Followers::Shared>> Followers::interruptible;
+
+auto Followers::on_interrupt(const fuse_req_t req, void* const /*data*/) -> void {
+    auto target = std::shared_ptr<Shared>();
+    {
+        const auto guard = std::lock_guard(interruptible_lock);
+        const auto it    = interruptible.find(req);
+        if(it == interruptible.end()) {
+            return;
+        }
+        target = std::move(it->second);
+        interruptible.erase(it);
+    }
+    auto found = false;
+    {
+        const auto guard = std::lock_guard(target->lock);
+        for(auto it = target->reads.begin(); it != target->reads.end(); it += 1) {
+            if(it->req == req) {
+                target->reads.erase(it);
+                found = true;
+                break;
+            }
+        }
+    }
+    // not found means the request was already answered, or park() answers it
+    if(found) {
+        fuse_reply_err(req, EINTR);
+    }
+}
+
+auto Followers::forget(const fuse_req_t req) -> void {
+    const auto guard = std::lock_guard(interruptible_lock);
+    interruptible.erase(req);
+}
+
+auto Followers::park(const fuse_req_t req, Reader& reader, const size_t size, const bool nonblock, const Fetch& fetch) -> void {
+    // must be registered before taking the lock, it calls on_interrupt() right away if already interrupted
+    if(!nonblock) {
+        {
+            const auto guard = std::lock_guard(interruptible_lock);
+            interruptible.emplace(req, shared);
+        }
+        fuse_req_interrupt_func(req, on_interrupt, nullptr);
+    }
+
+    auto buf = std::vector<char>(size);
+    auto len = size_t(0);
+    auto err = 0;
+    {
+        const auto guard = std::lock_guard(shared->lock);
+        len              = fetch(reader, buf);
+        if(len == 0) {
+            if(nonblock) {
+                err = EAGAIN;
+            } else if(fuse_req_interrupted(req)) {
+                err = EINTR;
+            } else {
+                shared->reads.push_back({req, &reader, size});
+                return;
+            }
+        }
+    }
+    if(!nonblock) {
+        forget(req);
+    }
+    if(err != 0) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_buf(req, buf.data(), len);
+    }
+}
+
+auto Followers::poll(const Reader* const reader, fuse_pollhandle* const handle, const std::function<bool()>& ready) -> bool {
+    const auto guard = std::lock_guard(shared->lock);
+    if(ready()) {
+        if(handle != nullptr) {
+            fuse_pollhandle_destroy(handle);
+        }
+        return true;
+    }
+    if(handle == nullptr) {
+        return false;
+    }
+    // a poll() looping on a quiet file would pile up handles otherwise
+    for(auto& poll : shared->polls) {
+        if(poll.reader == reader) {
+            fuse_pollhandle_destroy(poll.handle);
+            poll.handle = handle;
+            return false;
+        }
+    }
+    shared->polls.push_back({reader, handle});
+    return false;
+}
+
+auto Followers::wake(const Fetch& fetch) -> void {
+    auto replies = std::vector<Reply>();
+    auto notify  = std::vector<PendingPoll>();
+    {
+        const auto guard = std::lock_guard(shared->lock);
+        if(shared->reads.empty() && shared->polls.empty()) {
+            return;
+        }
+        std::erase_if(shared->reads, [&fetch, &replies](const PendingRead& read) {
+            auto buf = std::vector<char>(read.size);
+            buf.resize(fetch(*read.reader, buf));
+            if(buf.empty()) {
+                return false;
+            }
+            replies.push_back({read.req, std::move(buf)});
+            return true;
+        });
+        notify.swap(shared->polls);
+    }
+    // replies write to /dev/fuse, so keep them out of the lock
+    for(const auto& reply : replies) {
+        forget(reply.req);
+        fuse_reply_buf(reply.req, reply.data.data(), reply.data.size());
+    }
+    for(const auto& poll : notify) {
+        fuse_lowlevel_notify_poll(poll.handle);
+        fuse_pollhandle_destroy(poll.handle);
+    }
+}
+
+Followers::~Followers() {
+    // the daemon is gone, pending readers see end of file
+    // an on_interrupt() running meanwhile holds its own reference to shared and finds nothing left to answer
+    auto pending = std::vector<PendingRead>();
+    auto notify  = std::vector<PendingPoll>();
+    {
+        const auto guard = std::lock_guard(shared->lock);
+        pending.swap(shared->reads);
+        notify.swap(shared->polls);
+    }
+    for(const auto& read : pending) {
+        forget(read.req);
+        fuse_reply_buf(read.req, nullptr, 0);
+    }
+    for(const auto& poll : notify) {
+        fuse_lowlevel_notify_poll(poll.handle);
+        fuse_pollhandle_destroy(poll.handle);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse_lowlevel.h>
+
+#include "log-spool.hpp"
+#include "message-buffer.hpp"
+
+// per open file state of stdout, stderr, state and the root files, stored in fuse_file_info::fh
+// the kernel serializes read() on one open file through f_pos_lock, so no locking is needed
+// except for position, which poll() reads from another thread
+struct Reader {
+    std::atomic_uint64_t position = 0; // stream position of the next byte to read
+    bool                 follow   = false;
+    // contents of /.status or /.metrics pinned by the read at offset 0, so that reads in a row see one version
+    // or the results of the last write to /.control, read from position
+    std::shared_ptr<const std::string> snapshot;
+};
+
+// reads from the cursor of the reader, from the spool if the position is older than the ring
+// if the writer lapped the reader, the read returns a marker line with the lost byte count instead of data
+auto read_from(const MessageBuffer& ring, Reader& reader, std::span<char> buf, const LogSpool* spool = nullptr) -> size_t;
+
+// reads and polls waiting for a ring to grow
+// parked requests do not occupy a fuse thread nor the worker thread
+class Followers {
+  public:
+    // copies bytes from reader.position into buf and advances it, returns the copied size
+    using Fetch = std::function<size_t(Reader& reader, std::span<char> buf)>;
+
+  private:
+    struct PendingRead {
+        fuse_req_t req;
+        Reader*    reader;
+        size_t     size;
+    };
+
+    struct Reply {
+        fuse_req_t        req;
+        std::vector<char> data;
+    };
+
+    // the newest handle of each open file, the kernel only waits on that one
+    struct PendingPoll {
+        const Reader*    reader;
+        fuse_pollhandle* handle;
+    };
+
+    // shared with on_interrupt(), which libfuse may call after the request was answered and this object destroyed
+    struct Shared {
+        std::mutex               lock;
+        std::vector<PendingRead> reads;
+        std::vector<PendingPoll> polls;
+    };
+
+    std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+
+    // blocking requests by request, on_interrupt() looks them up instead of taking a pointer that could dangle
+    static std::mutex                                              interruptible_lock;
+    static std::unordered_map<fuse_req_t, std::shared_ptr<Shared>> interruptible;
+
+    static auto on_interrupt(fuse_req_t req, void* data) -> void;
+    static auto forget(fuse_req_t req) -> void;
+
+  public:
+    // replies immediately if data is available or nonblock is set, parks the request otherwise
+    auto park(fuse_req_t req, Reader& reader, size_t size, bool nonblock, const Fetch& fetch) -> void;
+    // returns true if the reader has data, the handle is notified on the next wake() otherwise
+    // replaces the handle the reader parked before
+    auto poll(const Reader* reader, fuse_pollhandle* handle, const std::function<bool()>& ready) -> bool;
+    // called by the worker thread after the ring grew
+    auto wake(const Fetch& fetch) -> void;
+
+    ~Followers();
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "daemon.hpp"
+
+// inode number layout
+// 1:                        root directory
+// 2 .. (1 << kind_bits) - 1: reserved for files in the root directory
+// otherwise:                ((slot + 1) << kind_bits) | kind
+namespace ino {
+constexpr auto kind_bits = 6;
+constexpr auto kind_mask = (fuse_ino_t(1) << kind_bits) - 1;
+constexpr auto root      = fuse_ino_t(FUSE_ROOT_ID);
+
+static_assert(size_t(FileKind::Limit) <= kind_mask + 1);
+
+// files in the root directory, numbered from 2
+enum class RootFile : uint8_t {
+    Metrics = 0,
+    Events,
+    Status,
+    StatusBin,
+    Control,
+    Limit,
+};
+
+static_assert(size_t(RootFile::Limit) + 2 <= kind_mask + 1);
+
+inline auto make_root(const RootFile file) -> fuse_ino_t {
+    return fuse_ino_t(file) + 2;
+}
+
+inline auto is_root_file(const fuse_ino_t ino) -> bool {
+    return ino >= 2 && ino < make_root(RootFile::Limit);
+}
+
+inline auto root_file_of(const fuse_ino_t ino) -> RootFile {
+    return RootFile(ino - 2);
+}
+
+inline auto make(const uint32_t slot, const FileKind kind) -> fuse_ino_t {
+    return ((fuse_ino_t(slot) + 1) << kind_bits) | fuse_ino_t(kind);
+}
+
+inline auto is_daemon(const fuse_ino_t ino) -> bool {
+    return ino > kind_mask;
+}
+
+inline auto slot_of(const fuse_ino_t ino) -> uint32_t {
+    return (ino >> kind_bits) - 1;
+}
+
+inline auto kind_of(const fuse_ino_t ino) -> FileKind {
+    return FileKind(ino & kind_mask);
+}
+} // namespace ino
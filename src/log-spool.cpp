@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <span>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "log-spool.hpp"
+#include "macros/assert.hpp"
+#include "snapshot.hpp"
+
+auto LogSpool::path_of(const uint64_t seq) const -> std::string {
+    return build_string(stream, ".", seq);
+}
+
+LogSpool::SegmentFile::~SegmentFile() {
+    if(fd != -1) {
+        close(fd);
+    }
+}
+
+auto LogSpool::seal() -> void {
+    if(!active) {
+        return;
+    }
+    active.reset();
+    auto next = std::make_shared<std::vector<Segment>>(*segments.load());
+    if(next->empty()) {
+        return;
+    }
+    // an empty file can not be mapped, readers skip a segment without file
+    auto sealed = std::make_shared<SegmentFile>();
+    next->back().file = sealed->mapped.open(path_of(next->back().seq).data(), dir_fd) ? std::move(sealed) : nullptr;
+    segments.store(std::move(next));
+}
+
+auto LogSpool::rotate() -> bool {
+    seal();
+    const auto seq  = next_seq;
+    const auto file = std::make_shared<SegmentFile>();
+    next_seq += 1;
+    file->fd = openat(dir_fd, path_of(seq).data(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    ensure(file->fd >= 0, "failed to open log segment ", path_of(seq), ": ", strerror(errno));
+    active = file;
+    size   = 0;
+    opened = std::chrono::steady_clock::now();
+    on_disk.push_back(seq);
+
+    auto next = std::make_shared<std::vector<Segment>>(*segments.load());
+    next->push_back({.seq = seq, .start = spooled, .file = file});
+    segments.store(std::move(next));
+    trim();
+    return true;
+}
+
+auto LogSpool::trim() -> void {
+    while(on_disk.size() > max_segments) {
+        const auto seq = on_disk.front();
+        on_disk.pop_front();
+        if(unlinkat(dir_fd, path_of(seq).data(), 0) != 0 && errno != ENOENT) {
+            line_warn("failed to remove log segment ", path_of(seq), ": ", strerror(errno));
+        }
+        // releases the mapping, readers holding the list keep it until they are done
+        if(const auto current = segments.load(); !current->empty() && current->front().seq == seq) {
+            segments.store(std::make_shared<const std::vector<Segment>>(current->begin() + 1, current->end()));
+        }
+    }
+}
+
+auto LogSpool::open(const int root, const std::string& dir, const char* const name, const uint64_t position) -> bool {
+    ensure(mkdirat(root, dir.data(), 0755) == 0 || errno == EEXIST, "failed to create log directory ", dir, ": ", strerror(errno));
+    dir_fd = openat(root, dir.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ensure(dir_fd >= 0, "failed to open log directory ", dir, ": ", strerror(errno));
+    stream  = name;
+    spooled = position;
+
+    // segments of earlier runs count against the limit, new ones are numbered after them
+    const auto list = fdopendir(dup(dir_fd));
+    ensure(list != NULL, "fdopendir() failed: ", strerror(errno));
+    const auto prefix = stream + ".";
+    while(const auto entry = readdir(list)) {
+        const auto file = std::string_view(entry->d_name);
+        auto       seq  = uint64_t();
+        if(!file.starts_with(prefix)) {
+            continue;
+        }
+        const auto digits = file.substr(prefix.size());
+        if(const auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), seq); ec != std::errc() || ptr != digits.data() + digits.size()) {
+            continue;
+        }
+        on_disk.push_back(seq);
+    }
+    closedir(list);
+    std::sort(on_disk.begin(), on_disk.end());
+    next_seq = on_disk.empty() ? 0 : on_disk.back() + 1;
+    return true;
+}
+
+auto LogSpool::append(const MessageBuffer& ring) -> bool {
+    if(dir_fd == -1) {
+        return true;
+    }
+    const auto storage = ring.load();
+    const auto end     = storage->len.load(std::memory_order_relaxed);
+    const auto from    = std::max(spooled, storage->start(end));
+    if(from >= end) {
+        return true;
+    }
+    // a gap breaks the mapping from file offsets to stream positions, so it starts a new segment
+    const auto gap = from != spooled;
+    spooled        = from;
+    if(!active || gap || size >= segment_size || std::chrono::steady_clock::now() - opened >= segment_age) {
+        ensure(rotate());
+    }
+
+    // at most one wrap around, the worker is the writer of the ring too so nothing moves meanwhile
+    const auto sector_size = storage->data.size();
+    const auto cursor      = from % sector_size;
+    const auto len         = end - from;
+    const auto first       = std::min<uint64_t>(len, sector_size - cursor);
+    auto       iov         = std::array{
+        iovec{storage->data.data() + cursor, first},
+        iovec{storage->data.data(), len - first},
+    };
+    auto pieces = std::span(iov).first(len == first ? 1 : 2);
+    while(!pieces.empty()) {
+        const auto ret = writev(active->fd, pieces.data(), pieces.size());
+        if(ret < 0) {
+            // the rest is lost for the disk, the next append starts a new segment
+            line_warn("failed to write log segment ", path_of(on_disk.back()), ": ", strerror(errno));
+            seal();
+            spooled = end;
+            return false;
+        }
+        size += ret;
+        auto left = size_t(ret);
+        while(!pieces.empty() && left >= pieces.front().iov_len) {
+            left -= pieces.front().iov_len;
+            pieces = pieces.subspan(1);
+        }
+        if(!pieces.empty()) {
+            pieces.front().iov_base = static_cast<char*>(pieces.front().iov_base) + left;
+            pieces.front().iov_len -= left;
+        }
+    }
+    spooled = end;
+    return true;
+}
+
+auto LogSpool::is_open() const -> bool {
+    return dir_fd != -1;
+}
+
+auto LogSpool::pending(const MessageBuffer& ring) const -> uint64_t {
+    const auto end = ring.end();
+    return end > spooled ? end - spooled : 0;
+}
+
+auto LogSpool::start() const -> uint64_t {
+    const auto current = segments.load();
+    return current->empty() ? UINT64_MAX : current->front().start;
+}
+
+auto LogSpool::read_at(uint64_t& position, const std::span<char> buf) const -> size_t {
+    // dir_fd and stream are set before the first segment is published
+    const auto current = segments.load();
+    if(current->empty()) {
+        return 0;
+    }
+    auto from = std::max(position, current->front().start);
+    auto it   = std::upper_bound(current->begin(), current->end(), from, [](const uint64_t pos, const Segment& segment) {
+        return pos < segment.start;
+    });
+    for(it -= 1; it != current->end(); it += 1) {
+        const auto next     = it + 1;
+        const auto limit    = next != current->end() ? next->start - it->start : UINT64_MAX;
+        const auto offset   = from - it->start;
+        auto       copy_len = size_t(0);
+        if(it->file && !it->file->mapped.contents().empty()) {
+            const auto contents = it->file->mapped.contents();
+            const auto length   = std::min<uint64_t>(contents.size(), limit);
+            if(offset < length) {
+                copy_len = size_t(std::min<uint64_t>(length - offset, buf.size()));
+                std::memcpy(buf.data(), contents.data() + offset, copy_len);
+            }
+        } else if(it->file) {
+            const auto len = pread(it->file->fd, buf.data(), size_t(std::min<uint64_t>(buf.size(), limit - offset)), off_t(offset));
+            copy_len       = size_t(std::max(len, ssize_t(0)));
+        }
+        if(copy_len == 0) {
+            // short segment after a failed write, continue with the next one
+            if(next == current->end()) {
+                return 0;
+            }
+            from = next->start;
+            continue;
+        }
+        position = from + copy_len;
+        return copy_len;
+    }
+    return 0;
+}
+
+LogSpool::~LogSpool() {
+    if(dir_fd != -1) {
+        close(dir_fd);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "message-buffer.hpp"
+#include "snapshot.hpp"
+
+// copy of a log ring on disk, so that output outlives the ring at a fixed memory cost
+// segments are named "<stream>.<seq>" in the directory of the daemon and rotated by size and age
+// the worker thread appends, any thread reads
+class LogSpool {
+  private:
+    constexpr static auto segment_size = size_t(8) * 1024 * 1024;
+    constexpr static auto segment_age  = std::chrono::hours(1);
+    constexpr static auto max_segments = size_t(8); // per stream, older ones are removed
+
+    // a finished segment is mapped once, the one being written is read with pread()
+    struct SegmentFile {
+        int        fd = -1; // of the segment being written, which the worker appends through
+        MappedFile mapped;
+
+        SegmentFile() = default;
+        SegmentFile(const SegmentFile&) = delete;
+        ~SegmentFile();
+    };
+
+    struct Segment {
+        uint64_t                           seq;
+        uint64_t                           start; // stream position of the first byte
+        std::shared_ptr<const SegmentFile> file;  // null if nothing was written, readers keep it alive after trim()
+    };
+
+    int         dir_fd = -1;
+    std::string stream;
+
+    // worker thread
+    std::shared_ptr<SegmentFile>          active;       // newest segment, null after a write error until the next append
+    size_t                                size     = 0; // of the newest segment
+    uint64_t                              spooled  = 0; // stream position up to which the ring is on disk
+    uint64_t                              next_seq = 0;
+    std::chrono::steady_clock::time_point opened;
+    std::deque<uint64_t>                  on_disk; // every segment, oldest first, including those of earlier runs
+
+    // segments written in this run, which are the only ones mapping to stream positions
+    std::atomic<std::shared_ptr<const std::vector<Segment>>> segments = std::make_shared<const std::vector<Segment>>();
+
+    auto path_of(uint64_t seq) const -> std::string;
+    // maps the newest segment for readers, it is not written anymore
+    auto seal() -> void;
+    auto rotate() -> bool;
+    auto trim() -> void;
+
+  public:
+    // worker thread
+    // dir is created under root if needed, spooling starts from the stream position
+    auto open(int root, const std::string& dir, const char* name, uint64_t position) -> bool;
+    // writes the ring from the last call on, called before the unspooled part grows beyond the ring
+    auto append(const MessageBuffer& ring) -> bool;
+    auto is_open() const -> bool;
+    // bytes in the ring which are not on disk yet
+    auto pending(const MessageBuffer& ring) const -> uint64_t;
+
+    // any thread
+    // stream position of the oldest byte on disk, or UINT64_MAX if there is none
+    auto start() const -> uint64_t;
+    // like MessageBuffer::read_at(), returns 0 if position is not on disk
+    auto read_at(uint64_t& position, std::span<char> buf) const -> size_t;
+
+    LogSpool() = default;
+    LogSpool(const LogSpool&) = delete;
+    ~LogSpool();
+};
@@ -1,8 +1,13 @@
+#include <bit>
 #include <filesystem>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
@@ -10,6 +15,7 @@
 
 #include "daemonfs.hpp"
 #include "macros/assert.hpp"
+#include "metrics.hpp"
 #include "util/argument-parser.hpp"
 
 namespace {
@@ -17,103 +23,203 @@ auto fs = (DaemonFS*)(nullptr);
 
 auto bootstrap_path = std::string();
 
-auto getattr(const char* const path, Stat* const stbuf, fuse_file_info* /*fi*/) -> int {
-    return fs->remote_command<Commands::GetAttr>(path, stbuf);
+// set across the exec of an upgrade
+constexpr auto resume_env = "DAEMONFS_RESUME";
+
+auto reply_result(const fuse_req_t req, const int result) -> void {
+    fuse_reply_err(req, result < 0 ? -result : 0);
+}
+
+auto lookup(const fuse_req_t req, const fuse_ino_t parent, const char* const name) -> void {
+    const auto scope = metrics::Scope(metrics::Op::Lookup);
+    auto       entry  = fuse_entry_param();
+    const auto result = fs->lookup(parent, name, entry);
+    if(result != 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_entry(req, &entry);
 }
 
-auto mkdir(const char* const path, const mode_t /*mode*/) -> int {
-    return fs->remote_command<Commands::MakeDir>(path);
+auto getattr(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const /*fi*/) -> void {
+    const auto scope = metrics::Scope(metrics::Op::GetAttr);
+    auto       stat    = Stat();
+    auto       timeout = 0.0;
+    const auto result  = fs->getattr(ino, stat, timeout);
+    if(result != 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_attr(req, &stat, timeout);
+}
+
+auto setattr(const fuse_req_t req, const fuse_ino_t ino, Stat* const attr, const int to_set, fuse_file_info* const fi) -> void {
+    const auto scope = metrics::Scope(metrics::Op::SetAttr);
+    if(!(to_set & FUSE_SET_ATTR_SIZE)) {
+        reply_result(req, -ENOSYS);
+        return;
+    }
+    if(const auto result = fs->remote_command<Commands::Truncate>(ino, attr->st_size); result != 0) {
+        reply_result(req, result);
+        return;
+    }
+    getattr(req, ino, fi);
 }
 
-auto rmdir(const char* const path) -> int {
-    return fs->remote_command<Commands::RemoveDir>(path);
+auto mkdir(const fuse_req_t req, const fuse_ino_t parent, const char* const name, const mode_t /*mode*/) -> void {
+    const auto scope = metrics::Scope(metrics::Op::MkDir);
+    auto       entry  = fuse_entry_param();
+    const auto result = fs->remote_command<Commands::MakeDir>(parent, name, &entry);
+    if(result != 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_entry(req, &entry);
 }
 
-auto readdir(const char* const path, void* const buf, const fuse_fill_dir_t filler, const off_t /*offset*/, fuse_file_info* const /*fi*/, const fuse_readdir_flags /*flags*/) -> int {
-    return fs->remote_command<Commands::ReadDir>(path, buf, filler);
+auto rmdir(const fuse_req_t req, const fuse_ino_t parent, const char* const name) -> void {
+    const auto scope = metrics::Scope(metrics::Op::RmDir);
+    reply_result(req, fs->remote_command<Commands::RemoveDir>(parent, name));
 }
 
-auto truncate(const char* const path, const off_t offset, fuse_file_info* /*fi*/) -> int {
-    return fs->remote_command<Commands::Truncate>(path, offset);
+auto reader_of(const fuse_file_info* const fi) -> Reader* {
+    return fi != nullptr ? std::bit_cast<Reader*>(uintptr_t(fi->fh)) : nullptr;
 }
 
-auto open(const char* const /*path*/, fuse_file_info* const fi) -> int {
+auto open(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const fi) -> void {
+    const auto scope = metrics::Scope(metrics::Op::Open);
     fi->direct_io   = 1;
     fi->nonseekable = 1;
     fi->noflush     = 1;
-    return 0;
+    // stdout and stderr keep a cursor per open file
+    // opened with O_APPEND, reads block until the daemon writes more, like tail -f
+    auto reader = std::unique_ptr<Reader>();
+    if(const auto result = fs->open(ino, fi->flags, reader); result != 0) {
+        reply_result(req, result);
+        return;
+    }
+    fi->fh = std::bit_cast<uintptr_t>(reader.release());
+    if(fuse_reply_open(req, fi) != 0) {
+        // open was interrupted, release() will not come
+        delete reader_of(fi);
+    }
+}
+
+auto release(const fuse_req_t req, const fuse_ino_t /*ino*/, fuse_file_info* const fi) -> void {
+    const auto scope = metrics::Scope(metrics::Op::Release);
+    delete reader_of(fi);
+    reply_result(req, 0);
+}
+
+auto read(const fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t offset, fuse_file_info* const fi) -> void {
+    const auto scope = metrics::Scope(metrics::Op::Read);
+    const auto reader = reader_of(fi);
+    if(reader != nullptr && reader->follow) {
+        if(const auto result = fs->follow(req, ino, *reader, size, fi->flags & O_NONBLOCK); result != 0) {
+            reply_result(req, result);
+        }
+        return;
+    }
+    if(reader != nullptr && fs->zero_copy) {
+        const auto result = fs->read_buf(ino, *reader, size, [req](fuse_bufvec& buf) {
+            fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+        });
+        if(result != -ENOTSUP) {
+            if(result < 0) {
+                reply_result(req, result);
+            }
+            return;
+        }
+    }
+
+    auto       buf    = std::vector<char>(size);
+    const auto result = fs->read(ino, reader, buf.data(), offset, size);
+    if(result < 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_buf(req, buf.data(), result);
+}
+
+auto write(const fuse_req_t req, const fuse_ino_t ino, const char* const buf, const size_t size, const off_t offset, fuse_file_info* const fi) -> void {
+    const auto scope  = metrics::Scope(metrics::Op::Write);
+    const auto reader = reader_of(fi);
+    const auto result = ino == ino::make_root(ino::RootFile::Control) && reader != nullptr
+                            ? fs->control(buf, size, *reader)
+                            : fs->remote_command<Commands::Write>(ino, buf, offset, size);
+    if(result < 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_write(req, result);
 }
 
-auto read(const char* const path, char* const buf, const size_t size, const off_t offset, fuse_file_info* const /*fi*/) -> int {
-    return fs->remote_command<Commands::Read>(path, buf, offset, size);
+auto poll(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const fi, fuse_pollhandle* const handle) -> void {
+    const auto scope = metrics::Scope(metrics::Op::Poll);
+    auto       revents = 0u;
+    const auto result  = fs->poll(ino, reader_of(fi), handle, revents);
+    if(result != 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_poll(req, revents);
 }
 
-auto write(const char* const path, const char* const buf, const size_t size, const off_t offset, fuse_file_info* const /*fi*/) -> int {
-    return fs->remote_command<Commands::Write>(path, buf, offset, size);
+auto readdir(const fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t offset, fuse_file_info* const /*fi*/) -> void {
+    const auto scope = metrics::Scope(metrics::Op::ReadDir);
+    auto buf = std::vector<char>();
+    buf.reserve(size);
+    const auto result = fs->readdir(req, ino, size, offset, buf);
+    if(result < 0) {
+        reply_result(req, result);
+        return;
+    }
+    fuse_reply_buf(req, buf.data(), buf.size());
 }
 
-auto init(fuse_conn_info* /*conn*/, fuse_config* /*cfg*/) -> void* {
-    if(!bootstrap_path.empty()) {
-        fs->add_oneshot_daemon("bootstrap", std::move(bootstrap_path));
+auto init(void* /*userdata*/, fuse_conn_info* const conn) -> void {
+    if(fs->zero_copy) {
+        conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+    }
+    if(!bootstrap_path.empty() && !fs->resumed) {
+        // the registry belongs to the worker, which is already running
+        fs->remote_command<Commands::Bootstrap>(bootstrap_path.data());
     }
-    return NULL;
 }
 
-const auto operations = fuse_operations{
-    .getattr         = getattr,
-    .readlink        = NULL,
-    .mknod           = NULL,
-    .mkdir           = mkdir,
-    .unlink          = NULL,
-    .rmdir           = rmdir,
-    .symlink         = NULL,
-    .rename          = NULL,
-    .link            = NULL,
-    .chmod           = NULL,
-    .chown           = NULL,
-    .truncate        = truncate,
-    .open            = open,
-    .read            = read,
-    .write           = write,
-    .statfs          = NULL,
-    .flush           = NULL,
-    .release         = NULL,
-    .fsync           = NULL,
-    .setxattr        = NULL,
-    .getxattr        = NULL,
-    .listxattr       = NULL,
-    .removexattr     = NULL,
-    .opendir         = NULL,
-    .readdir         = readdir,
-    .releasedir      = NULL,
-    .fsyncdir        = NULL,
-    .init            = init,
-    .destroy         = NULL,
-    .access          = NULL,
-    .create          = NULL,
-    .lock            = NULL,
-    .utimens         = NULL,
-    .bmap            = NULL,
-    .ioctl           = NULL,
-    .poll            = NULL,
-    .write_buf       = NULL,
-    .read_buf        = NULL,
-    .flock           = NULL,
-    .fallocate       = NULL,
-    .copy_file_range = NULL,
-    .lseek           = NULL,
+const auto operations = fuse_lowlevel_ops{
+    .init    = init,
+    .lookup  = lookup,
+    .getattr = getattr,
+    .setattr = setattr,
+    .mkdir   = mkdir,
+    .rmdir   = rmdir,
+    .open    = open,
+    .read    = read,
+    .write   = write,
+    .release = release,
+    .readdir = readdir,
+    .poll    = poll,
 };
 } // namespace
 
 auto main(const int argc, char** argv) -> int {
     auto mountpoint = (const char*)(nullptr);
     auto bootstrap  = (const char*)(nullptr);
+    auto cgroup     = (const char*)(nullptr);
+    auto log_dir    = (const char*)(nullptr);
+    auto snapshot   = (const char*)(nullptr);
     auto verbose    = false;
+    auto zero_copy  = false;
     auto help       = false;
     {
         auto parser = args::Parser();
         parser.kwarg(&bootstrap, {"-b"}, {"EXE", "bootstrap script", args::State::Initialized});
+        parser.kwarg(&cgroup, {"-c", "--cgroup"}, {"DIR", "place each daemon into a child cgroup of this cgroup v2 directory", args::State::Initialized});
+        parser.kwarg(&log_dir, {"-l", "--log-dir"}, {"DIR", "keep daemon outputs older than the rings in rotated files under this directory", args::State::Initialized});
+        parser.kwarg(&snapshot, {"-s", "--snapshot"}, {"FILE", "persist daemons to this file, SIGUSR2 upgrades daemonfs in place", args::State::Initialized});
         parser.kwarg(&verbose, {"-v", "--verbose"}, {.arg_desc = "enable verbose outputs", .state = args::State::Initialized});
+        parser.kwarg(&zero_copy, {"-z", "--zero-copy"}, {.arg_desc = "capture daemon outputs with splice() into memfd backed rings", .state = args::State::Initialized});
         parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print help message", .state = args::State::Initialized, .no_error_check = true});
         parser.arg(&mountpoint, {.arg_desc = "mountpoint"});
         if(!parser.parse(argc, argv) || help) {
@@ -123,16 +229,45 @@ auto main(const int argc, char** argv) -> int {
     }
     bootstrap_path = bootstrap != nullptr ? std::filesystem::absolute(bootstrap).string() : std::string();
 
-    fs          = new DaemonFS();
-    fs->verbose = verbose;
+    fs = new DaemonFS();
+    if(const auto token = getenv(resume_env); token != nullptr) {
+        // daemons must not inherit it
+        fs->resume_token = strtoull(token, nullptr, 10);
+        unsetenv(resume_env);
+    }
+    fs->verbose       = verbose;
+    fs->zero_copy     = zero_copy;
+    fs->cgroup_path   = cgroup;
+    fs->log_path      = log_dir;
+    fs->snapshot_path = snapshot;
     ensure(fs->init());
     auto worker = std::thread([]() { fs->run(); });
 
-    const auto args = std::array{"daemonfs", "-f", "-o", "default_permissions", mountpoint};
-    const auto ret  = fuse_main(args.size(), (char**)args.data(), &operations, NULL);
-    fs->remote_command<Commands::Quit>();
-
+    const auto fuse_argv = std::array{"daemonfs", "-o", "default_permissions"};
+    auto       fuse_arg  = fuse_args FUSE_ARGS_INIT(fuse_argv.size(), (char**)fuse_argv.data());
+    const auto session   = fuse_session_new(&fuse_arg, &operations, sizeof(operations), NULL);
+    ensure(session != NULL);
+    ensure(fuse_set_signal_handlers(session) == 0);
+    ensure(fuse_session_mount(session, mountpoint) == 0);
+    fs->start_notifier(session);
+    const auto ret = fuse_session_loop_mt(session, 0);
+    fs->stop_notifier();
+    // parked reads and poll handles are still answered while the worker stops, so the session outlives it
+    const auto upgrade = fs->upgrading && fs->remote_command<Commands::Upgrade>() == 0;
+    if(!upgrade) {
+        fs->remote_command<Commands::Quit>();
+    }
     worker.join();
+    fuse_session_unmount(session);
+    fuse_remove_signal_handlers(session);
+    fuse_session_destroy(session);
+    if(upgrade) {
+        // the same pid keeps the daemons as children, the new image takes them over from the snapshot
+        setenv(resume_env, std::to_string(fs->resume_token).data(), 1);
+        execv("/proc/self/exe", argv);
+        warn("execv() failed: ", strerror(errno));
+        return 1;
+    }
 
-    return ret;
+    return ret == 0 ? 0 : 1;
 }
@@ -0,0 +1,116 @@
+#include <atomic>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "macros/assert.hpp"
+#include "message-buffer.hpp"
+
+namespace {
+constexpr auto readers     = 8;
+constexpr auto total_bytes = uint64_t(64) * 1024 * 1024;
+
+// every stream position has a known byte, so readers can verify what they got
+auto pattern(const uint64_t position) -> char {
+    return char((position * 131) ^ (position >> 11));
+}
+
+auto fill(std::vector<char>& buf, const uint64_t position) -> void {
+    for(auto i = size_t(0); i < buf.size(); i += 1) {
+        buf[i] = pattern(position + i);
+    }
+}
+
+struct ReaderStats {
+    uint64_t bytes  = 0;
+    uint64_t lost   = 0;
+    uint64_t errors = 0;
+};
+
+auto run_reader(const MessageBuffer& mb, const std::atomic_bool& done, const size_t read_size, ReaderStats& stats) -> void {
+    auto buf      = std::vector<char>(read_size);
+    auto position = uint64_t(0);
+    while(!done.load(std::memory_order_relaxed) || position < mb.end()) {
+        const auto prev = position;
+        const auto len  = mb.read_at(position, buf);
+        const auto from = position - len;
+        stats.lost += from - prev;
+        stats.bytes += len;
+        for(auto i = size_t(0); i < len; i += 1) {
+            stats.errors += buf[i] != pattern(from + i);
+        }
+    }
+}
+
+// write_from_fd == false: producer copies with write()
+// write_from_fd == true: producer reads from a pipe with write_from_fd(), like drain_pipe()
+auto run(const bool from_fd, const size_t ring_size) -> bool {
+    auto mb = MessageBuffer();
+    mb.resize(ring_size);
+
+    auto done  = std::atomic_bool(false);
+    auto stats = std::array<ReaderStats, readers>();
+    auto pool  = std::vector<std::thread>();
+    for(auto i = 0; i < readers; i += 1) {
+        // odd sizes so that reads straddle the wrap point at varying offsets
+        pool.emplace_back(run_reader, std::cref(mb), std::cref(done), size_t(4096 + i * 997), std::ref(stats[i]));
+    }
+
+    auto engine   = std::mt19937(ring_size);
+    auto chunk    = std::vector<char>();
+    auto pipefd   = std::array<int, 2>();
+    auto position = uint64_t(0);
+    if(from_fd) {
+        ensure(pipe2(pipefd.data(), O_NONBLOCK) == 0);
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    while(position < total_bytes) {
+        chunk.resize(std::uniform_int_distribution<size_t>(1, 16 * 1024)(engine));
+        fill(chunk, position);
+        if(!from_fd) {
+            ensure(mb.write(chunk) == chunk.size());
+        } else {
+            ensure(write(pipefd[1], chunk.data(), chunk.size()) == ssize_t(chunk.size()));
+            for(auto left = chunk.size(); left > 0;) {
+                const auto ret = mb.write_from_fd(pipefd[0]);
+                ensure(ret > 0);
+                left -= ret;
+            }
+        }
+        position += chunk.size();
+        if((position >> 24) != ((position - chunk.size()) >> 24)) {
+            // swap the storage under the readers every 16MiB
+            mb.resize(ring_size);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    done.store(true);
+    for(auto& thread : pool) {
+        thread.join();
+    }
+    if(from_fd) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+
+    const auto elapsed = std::chrono::duration<double>(end - begin).count();
+    print(from_fd ? "write_from_fd" : "write", " ring=", ring_size, " ", double(position) / elapsed / (1024 * 1024), "MiB/s");
+    for(auto i = 0; i < readers; i += 1) {
+        print("  reader ", i, " bytes=", stats[i].bytes, " lost=", stats[i].lost, " errors=", stats[i].errors);
+        ensure(stats[i].errors == 0, "reader ", i, " saw corrupted data");
+        ensure(stats[i].bytes + stats[i].lost == position, "reader ", i, " missed bytes without noticing");
+    }
+    return true;
+}
+} // namespace
+
+auto main() -> int {
+    for(const auto ring_size : {4096, 64 * 1024, 1024 * 1024}) {
+        ensure(run(false, ring_size));
+        ensure(run(true, ring_size));
+    }
+    print("pass");
+    return 0;
+}
@@ -3,18 +3,14 @@
 
 namespace {
 auto debug_print(const MessageBuffer& mb) -> void {
-    printf("size=%lu len=%lu\n", mb.data.size(), mb.len);
-    if(mb.len >= mb.data.size()) {
-        for(auto i = 0u; i < mb.data.size(); i += 1) {
-            printf("%c", mb.data[i]);
-        }
-    } else {
-        for(auto i = 0u; i < mb.len; i += 1) {
-            printf("%c", mb.data[i]);
-        }
-        for(auto i = mb.len; i < mb.data.size(); i += 1) {
-            printf(".");
-        }
+    const auto ring   = mb.load();
+    const auto size   = ring->data.size();
+    const auto len    = ring->len.load();
+    const auto filled = len - ring->start(len);
+    printf("size=%lu len=%lu filled=%lu\n", size, len, filled);
+    for(auto i = 0u; i < size; i += 1) {
+        const auto offset = (i + size - ring->start(len) % size) % size;
+        printf("%c", offset < filled ? ring->data[i] : '.');
     }
     printf("\n");
 }
@@ -69,5 +65,17 @@ auto main() -> int {
     mb.resize(size);
     dump();
 
+    // cursors keep absolute stream positions across wraps
+    mb.write({"0123", 4});
+    auto position = mb.start();
+    auto buf      = std::array<char, size>();
+    ensure(mb.read_at(position, buf) == 4 && position == mb.end());
+    ensure(mb.read_at(position, buf) == 0);
+    mb.write({"456789abcdef", 12});
+    ensure(mb.overrun(position) == 4);
+    ensure(mb.read_at(position, buf) == 8 && std::string_view(buf.data(), 8) == "89abcdef");
+    ensure(mb.overrun(position) == 0);
+    print("cursor: ok");
+
     return 0;
 }
@@ -1,57 +1,230 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "macros/assert.hpp"
 #include "message-buffer.hpp"
 
-auto MessageBuffer::resize(const size_t size) -> void {
-    auto new_data = std::vector<char>(size);
+namespace {
+auto map_memfd(const size_t size) -> std::pair<int, char*> {
+    const auto fd = memfd_create("daemonfs-ring", MFD_CLOEXEC);
+    ensure(fd >= 0, "memfd_create() failed: ", strerror(errno));
+    if(ftruncate(fd, size) != 0) {
+        close(fd);
+        bail("ftruncate() failed: ", strerror(errno));
+    }
+    const auto ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        close(fd);
+        bail("mmap() failed: ", strerror(errno));
+    }
+    return {fd, (char*)ptr};
+}
 
-    len  = read(0, new_data);
-    data = std::move(new_data);
+auto unmap_memfd(const int fd, const std::span<char> data) -> void {
+    if(fd != -1) {
+        munmap(data.data(), data.size());
+        close(fd);
+    }
+}
+auto copy_out(const RingStorage& ring, const uint64_t position, const std::span<char> buf) -> void {
+    const auto sector_size = ring.data.size();
+    const auto cursor      = position % sector_size;
+    const auto first       = std::min(buf.size(), sector_size - cursor);
+    memcpy(buf.data(), ring.data.data() + cursor, first);
+    memcpy(buf.data() + first, ring.data.data(), buf.size() - first);
 }
+} // namespace
 
-auto MessageBuffer::read(size_t offset, std::span<char> buf) const -> size_t {
-    if(offset >= len || offset >= data.size()) {
-        return 0;
+RingStorage::~RingStorage() {
+    unmap_memfd(memfd, data);
+}
+
+auto RingStorage::start(const uint64_t end) const -> uint64_t {
+    return std::max(base, end > data.size() ? end - data.size() : 0);
+}
+
+auto RingStorage::locate(uint64_t position, const size_t size) const -> std::pair<size_t, size_t> {
+    const auto end = len.load(std::memory_order_acquire);
+    position       = std::max(position, start(end));
+    if(position >= end) {
+        return {0, 0};
     }
+    const auto sector_size = data.size();
+    const auto cursor      = position % sector_size;
+    return {cursor, size_t(std::min<uint64_t>({size, end - position, sector_size - cursor}))};
+}
 
-    const auto original_buf_size = buf.size();
-    const auto sector_size       = data.size();
+MessageBuffer::MessageBuffer()
+    : current(new RingStorage()),
+      published(current) {
+}
 
-    if(len < data.size()) {
-        const auto copy_len = std::min(len - offset, buf.size());
-        memcpy(buf.data(), data.data() + offset, copy_len);
-        return copy_len;
+auto MessageBuffer::reserve(const uint64_t end) -> void {
+    // same protocol as SeqLock, the fence keeps the byte stores after the reservation
+    current->reserved.store(end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+auto MessageBuffer::resize(const size_t size) -> void {
+    auto next = std::shared_ptr<RingStorage>(new RingStorage());
+    if(use_memfd && size > 0) {
+        const auto [fd, ptr] = map_memfd(size);
+        if(ptr != nullptr) {
+            next->memfd = fd;
+            next->data  = {ptr, size};
+        } else {
+            warn("falling back to heap ring");
+        }
+    }
+    if(next->memfd == -1) {
+        next->heap.resize(size);
+        next->data = next->heap;
     }
 
-    const auto end        = len % sector_size;
-    const auto behind_end = sector_size - end;
-    if(behind_end > offset) {
-        const auto copy_len = std::min(behind_end - offset, buf.size());
-        memcpy(buf.data(), data.data() + end + offset, copy_len);
-        buf    = buf.subspan(copy_len);
-        offset = 0;
-    } else {
-        offset -= behind_end;
+    // keep the newest bytes at the same stream positions
+    const auto end  = current->len.load(std::memory_order_relaxed);
+    const auto keep = std::min(end - current->start(end), uint64_t(size));
+    if(keep > 0) {
+        auto tail = std::vector<char>(keep);
+        copy_out(*current, end - keep, tail);
+        for(auto done = size_t(0); done < keep;) {
+            const auto cursor   = (end - keep + done) % size;
+            const auto copy_len = std::min(keep - done, size - cursor);
+            memcpy(next->data.data() + cursor, tail.data() + done, copy_len);
+            done += copy_len;
+        }
     }
-    const auto ahead_end = sector_size - behind_end;
-    const auto copy_len  = std::min(ahead_end - offset, buf.size());
-    memcpy(buf.data(), data.data() + offset, copy_len);
-    return std::min(original_buf_size, sector_size - offset);
+    next->base     = end - keep;
+    next->len      = end;
+    next->reserved = end;
+
+    // readers still holding the old storage keep reading it until they drop it
+    current = std::move(next);
+    published.store(current);
 }
 
 auto MessageBuffer::write(std::span<const char> buf) -> size_t {
-    if(data.size() == 0) {
+    auto& ring = *current;
+    if(ring.data.size() == 0) {
         return 0;
     }
 
     const auto original_buf_size = buf.size();
-    const auto sector_size       = data.size();
+    const auto sector_size       = ring.data.size();
+    auto       end               = ring.len.load(std::memory_order_relaxed);
+    if(buf.size() > sector_size) {
+        // only the last sector_size bytes survive
+        end += buf.size() - sector_size;
+        buf = buf.last(sector_size);
+    }
+
+    reserve(end + buf.size());
     while(!buf.empty()) {
-        const auto cursor     = len % sector_size;
+        const auto cursor     = end % sector_size;
         const auto free_space = sector_size - cursor;
         const auto copy_len   = std::min(buf.size(), free_space);
-        memcpy(data.data() + cursor, buf.data(), copy_len);
+        memcpy(ring.data.data() + cursor, buf.data(), copy_len);
         buf = buf.subspan(copy_len);
-        len += copy_len;
+        end += copy_len;
     }
+    ring.len.store(end, std::memory_order_release);
 
     return original_buf_size;
 }
+
+auto MessageBuffer::write_from_fd(const int fd) -> ssize_t {
+    auto&      ring        = *current;
+    const auto sector_size = ring.data.size();
+    // readers lagging less than the other half never have to retry
+    const auto limit = std::max(sector_size / 2, size_t(1));
+    auto       end   = ring.len.load(std::memory_order_relaxed);
+    if(ring.memfd == -1) {
+        const auto cursor = end % sector_size;
+        const auto first  = std::min(limit, sector_size - cursor);
+        auto       iov    = std::array{
+            iovec{ring.data.data() + cursor, first},
+            iovec{ring.data.data(), limit - first},
+        };
+        reserve(end + limit);
+        const auto ret = readv(fd, iov.data(), limit == first ? 1 : 2);
+        end += std::max(ret, ssize_t(0));
+        ring.reserved.store(end, std::memory_order_relaxed);
+        ring.len.store(end, std::memory_order_release);
+        return ret;
+    }
+
+    // splice() takes a single range, so wrap around by hand
+    auto total = size_t(0);
+    while(total < limit) {
+        const auto cursor    = end % sector_size;
+        const auto requested = std::min(sector_size - cursor, limit - total);
+        auto       pos       = loff_t(cursor);
+        reserve(end + requested);
+        const auto ret = splice(fd, NULL, ring.memfd, &pos, requested, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        end += std::max(ret, ssize_t(0));
+        ring.reserved.store(end, std::memory_order_relaxed);
+        ring.len.store(end, std::memory_order_release);
+        if(ret <= 0) {
+            return total > 0 ? ssize_t(total) : ret;
+        }
+        total += ret;
+        if(size_t(ret) < requested) {
+            break;
+        }
+    }
+    return total;
+}
+
+auto MessageBuffer::load() const -> std::shared_ptr<const RingStorage> {
+    return published.load();
+}
+
+auto MessageBuffer::capacity() const -> size_t {
+    return load()->data.size();
+}
+
+auto MessageBuffer::end() const -> uint64_t {
+    return load()->len.load(std::memory_order_acquire);
+}
+
+auto MessageBuffer::start() const -> uint64_t {
+    const auto ring = load();
+    return ring->start(ring->len.load(std::memory_order_acquire));
+}
+
+auto MessageBuffer::read(const size_t offset, const std::span<char> buf) const -> size_t {
+    auto position = start() + offset;
+    return read_at(position, buf);
+}
+
+auto MessageBuffer::read_at(uint64_t& position, const std::span<char> buf) const -> size_t {
+    const auto ring        = load();
+    const auto sector_size = ring->data.size();
+    while(true) {
+        const auto end      = ring->len.load(std::memory_order_acquire);
+        const auto from     = std::max(position, ring->start(end));
+        if(from >= end) {
+            position = from;
+            return 0;
+        }
+        const auto copy_len = size_t(std::min<uint64_t>(end - from, buf.size()));
+        // the producer may be writing these bytes right now, the copy is thrown away in that case
+        copy_out(*ring, from, buf.first(copy_len));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(ring->reserved.load(std::memory_order_relaxed) <= from + sector_size) {
+            position = from + copy_len;
+            return copy_len;
+        }
+    }
+}
+
+auto MessageBuffer::overrun(const uint64_t position) const -> uint64_t {
+    const auto oldest = start();
+    return position < oldest ? oldest - position : 0;
+}
@@ -1,13 +1,71 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <span>
+#include <utility>
 #include <vector>
 
-struct MessageBuffer {
-    std::vector<char> data;
-    size_t            len;
+#include <sys/types.h>
 
+// ring memory and stream positions, replaced as a whole by MessageBuffer::resize()
+struct RingStorage {
+    std::span<char>   data;
+    int               memfd = -1;
+    std::vector<char> heap;
+    uint64_t          base = 0; // oldest stream position this storage ever held
+
+    // bytes are written between reserved and len
+    // bytes older than reserved - data.size() may be overwritten by the write in progress
+    std::atomic_uint64_t len      = 0;
+    std::atomic_uint64_t reserved = 0;
+
+    // stream position of the oldest byte when the end is at end
+    auto start(uint64_t end) const -> uint64_t;
+    // physical position and length of the contiguous range starting at the stream position
+    auto locate(uint64_t position, size_t size) const -> std::pair<size_t, size_t>;
+
+    RingStorage() = default;
+    RingStorage(const RingStorage&) = delete;
+    ~RingStorage();
+};
+
+// single producer, many consumers
+// the producer never waits for consumers, consumers copy optimistically and retry if a write overlapped the copy
+class MessageBuffer {
+  private:
+    std::shared_ptr<RingStorage>              current; // producer's reference
+    std::atomic<std::shared_ptr<RingStorage>> published;
+
+    auto reserve(uint64_t end) -> void;
+
+  public:
+    // back the ring with a memfd, so that it can be filled and read with splice()
+    // takes effect on the next resize()
+    bool use_memfd = false;
+
+    // producer
     auto resize(size_t size) -> void;
-    auto read(size_t offset, std::span<char> buf) const -> size_t;
     auto write(std::span<const char> buf) -> size_t;
-};
+    // reads from fd directly into the ring, up to half of the ring size
+    // returns total bytes read, or result of readv()/splice() if nothing was read
+    auto write_from_fd(int fd) -> ssize_t;
 
+    // any thread
+    auto load() const -> std::shared_ptr<const RingStorage>;
+    auto capacity() const -> size_t;
+    // stream position of the end, i.e. total bytes written
+    auto end() const -> uint64_t;
+    // stream position of the oldest byte in the ring
+    auto start() const -> uint64_t;
+    // offset is relative to start()
+    auto read(size_t offset, std::span<char> buf) const -> size_t;
+    // reads from the stream position and sets it to the end of the copied range
+    // positions older than the ring are skipped, so position - copied size - old position is the lost byte count
+    auto read_at(uint64_t& position, std::span<char> buf) const -> size_t;
+    // bytes already overwritten between the stream position and start()
+    auto overrun(uint64_t position) const -> uint64_t;
+
+    MessageBuffer();
+    MessageBuffer(const MessageBuffer&) = delete;
+};
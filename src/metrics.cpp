@@ -0,0 +1,130 @@
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "macros/assert.hpp"
+#include "metrics.hpp"
+
+namespace metrics {
+namespace {
+const auto op_str = std::array{"lookup", "getattr", "setattr", "mkdir", "rmdir", "open", "read", "write", "release", "readdir", "poll"};
+static_assert(op_str.size() == size_t(Op::Limit));
+
+// bucket i counts operations which took at most 1us << i, slower ones are only in the count
+constexpr auto buckets = 24;
+
+struct OpStats {
+    std::atomic_uint64_t                      count     = 0;
+    std::atomic_uint64_t                      sum_ns    = 0;
+    std::array<std::atomic_uint64_t, buckets> histogram = {};
+};
+
+struct Shard {
+    std::array<OpStats, size_t(Op::Limit)> ops;
+};
+
+// shards outlive their threads and are handed to the next thread, so totals never go back
+std::mutex                          shards_lock;
+std::vector<std::unique_ptr<Shard>> shards;
+std::vector<Shard*>                 free_shards;
+
+auto acquire_shard() -> Shard* {
+    const auto lock = std::lock_guard(shards_lock);
+    if(!free_shards.empty()) {
+        const auto shard = free_shards.back();
+        free_shards.pop_back();
+        return shard;
+    }
+    return shards.emplace_back(new Shard()).get();
+}
+
+struct ThreadShard {
+    Shard* shard = acquire_shard();
+
+    ~ThreadShard() {
+        const auto lock = std::lock_guard(shards_lock);
+        free_shards.push_back(shard);
+    }
+};
+
+thread_local auto local = ThreadShard();
+
+// only the owner thread writes, so a plain load and store is enough
+auto add(std::atomic_uint64_t& counter, const uint64_t value) -> void {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+auto bucket_of(const std::chrono::nanoseconds elapsed) -> size_t {
+    const auto us = (uint64_t(elapsed.count()) + 999) / 1000;
+    return us <= 1 ? 0 : std::bit_width(us - 1);
+}
+} // namespace
+
+auto record(const Op op, const std::chrono::nanoseconds elapsed) -> void {
+    auto& stats = local.shard->ops[size_t(op)];
+    add(stats.count, 1);
+    add(stats.sum_ns, elapsed.count());
+    if(const auto bucket = bucket_of(elapsed); bucket < buckets) {
+        add(stats.histogram[bucket], 1);
+    }
+}
+
+auto format(std::string& out) -> void {
+    struct Total {
+        uint64_t                      count     = 0;
+        uint64_t                      sum_ns    = 0;
+        std::array<uint64_t, buckets> histogram = {};
+    };
+
+    auto totals = std::array<Total, size_t(Op::Limit)>();
+    {
+        const auto lock = std::lock_guard(shards_lock);
+        for(const auto& shard : shards) {
+            for(auto op = size_t(0); op < totals.size(); op += 1) {
+                const auto& stats = shard->ops[op];
+                totals[op].count += stats.count.load(std::memory_order_relaxed);
+                totals[op].sum_ns += stats.sum_ns.load(std::memory_order_relaxed);
+                for(auto i = 0; i < buckets; i += 1) {
+                    totals[op].histogram[i] += stats.histogram[i].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    out += "# TYPE daemonfs_operations_total counter\n";
+    for(auto op = size_t(0); op < totals.size(); op += 1) {
+        out += build_string("daemonfs_operations_total{op=\"", op_str[op], "\"} ", totals[op].count, "\n");
+    }
+    out += "# TYPE daemonfs_operation_duration_seconds histogram\n";
+    for(auto op = size_t(0); op < totals.size(); op += 1) {
+        const auto& total      = totals[op];
+        auto        cumulative = uint64_t(0);
+        for(auto i = 0; i < buckets; i += 1) {
+            cumulative += total.histogram[i];
+            out += build_string("daemonfs_operation_duration_seconds_bucket{op=\"", op_str[op], "\",le=\"", double(uint64_t(1) << i) / 1e6, "\"} ", cumulative, "\n");
+        }
+        out += build_string("daemonfs_operation_duration_seconds_bucket{op=\"", op_str[op], "\",le=\"+Inf\"} ", total.count, "\n");
+        out += build_string("daemonfs_operation_duration_seconds_sum{op=\"", op_str[op], "\"} ", double(total.sum_ns) / 1e9, "\n");
+        out += build_string("daemonfs_operation_duration_seconds_count{op=\"", op_str[op], "\"} ", total.count, "\n");
+    }
+}
+
+auto label(const std::string_view value) -> std::string {
+    auto str = std::string("\"");
+    for(const auto c : value) {
+        if(c == '\\' || c == '"') {
+            str += '\\';
+            str += c;
+        } else if(c == '\n') {
+            str += "\\n";
+        } else {
+            str += c;
+        }
+    }
+    str += '"';
+    return str;
+}
+} // namespace metrics
@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "time.hpp"
+
+// counters and latency histograms of the fuse operations
+// every thread writes its own shard without atomic read-modify-writes, readers sum the shards
+namespace metrics {
+enum class Op : uint8_t {
+    Lookup = 0,
+    GetAttr,
+    SetAttr,
+    MkDir,
+    RmDir,
+    Open,
+    Read,
+    Write,
+    Release,
+    ReadDir,
+    Poll,
+    Limit,
+};
+
+auto record(Op op, std::chrono::nanoseconds elapsed) -> void;
+// appends prometheus text of every operation
+auto format(std::string& out) -> void;
+// quotes a label value
+auto label(std::string_view value) -> std::string;
+
+// records the lifetime of the scope
+class Scope {
+  private:
+    Op          op;
+    SteadyPoint begin = std::chrono::steady_clock::now();
+
+  public:
+    Scope(const Op op)
+        : op(op) {
+    }
+
+    Scope(const Scope&) = delete;
+
+    ~Scope() {
+        record(op, std::chrono::steady_clock::now() - begin);
+    }
+};
+} // namespace metrics
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+
+// intrusive multi producer, single consumer queue
+// T needs a `T* next` member, nodes belong to the producer and must stay alive until the consumer is done with them
+template <class T>
+class MpscQueue {
+  private:
+    std::atomic<T*> head = nullptr;
+
+  public:
+    // returns true if the queue was empty, only then the consumer needs a wakeup
+    auto push(T& node) -> bool {
+        auto old = head.load(std::memory_order_relaxed);
+        do {
+            node.next = old;
+        } while(!head.compare_exchange_weak(old, &node, std::memory_order_release, std::memory_order_relaxed));
+        return old == nullptr;
+    }
+
+    // takes every queued node at once and calls fn oldest first
+    // fn may complete the node, so it is not touched after fn returns
+    template <class Fn>
+    auto drain(Fn fn) -> void {
+        auto node = head.exchange(nullptr, std::memory_order_acquire);
+        auto prev = (T*)(nullptr);
+        while(node != nullptr) {
+            const auto next = node->next;
+            node->next      = prev;
+            prev            = node;
+            node            = next;
+        }
+        while(prev != nullptr) {
+            const auto next = prev->next;
+            fn(*prev);
+            prev = next;
+        }
+    }
+};
@@ -0,0 +1,56 @@
+#include <chrono>
+#include <random>
+
+#include "macros/assert.hpp"
+#include "registry.hpp"
+
+namespace {
+constexpr auto lookups = 1'000'000;
+
+template <class Fn>
+auto measure(const char* const label, const size_t count, Fn fn) -> void {
+    const auto begin = std::chrono::steady_clock::now();
+    for(auto i = 0; i < lookups; i += 1) {
+        fn(i);
+    }
+    const auto end     = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    print(label, " daemons=", count, " ", double(elapsed) / lookups, "ns/op");
+}
+
+auto run(const size_t count) -> bool {
+    auto registry = Registry();
+    auto names    = std::vector<std::string>();
+    auto pids     = std::vector<pid_t>();
+    for(auto i = size_t(0); i < count; i += 1) {
+        const auto daemon = registry.insert(std::shared_ptr<Daemon>(new Daemon{.name = build_string("daemon-", i)}));
+        ensure(daemon != nullptr);
+        daemon->pid = pid_t(i + 100);
+        registry.bind_pid(*daemon);
+        names.emplace_back(daemon->name);
+        pids.emplace_back(daemon->pid);
+    }
+
+    // random access pattern, so that small registries do not get an unfair cache advantage from sequential access
+    auto engine  = std::mt19937(count);
+    auto indices = std::vector<size_t>(lookups);
+    for(auto& index : indices) {
+        index = std::uniform_int_distribution<size_t>(0, count - 1)(engine);
+    }
+
+    auto found = size_t(0);
+    measure("lookup", count, [&](const int i) { found += registry.lookup(names[indices[i]]) != nullptr; });
+    measure("find", count, [&](const int i) { found += registry.find(names[indices[i]]) != nullptr; });
+    measure("find_by_pid", count, [&](const int i) { found += registry.find_by_pid(pids[indices[i]]) != nullptr; });
+    measure("load", count, [&](const int i) { found += registry.load(uint32_t(indices[i])) != nullptr; });
+    ensure(found == size_t(lookups) * 4);
+    return true;
+}
+} // namespace
+
+auto main() -> int {
+    for(const auto count : {10, 100, 1'000, 10'000, 100'000}) {
+        ensure(run(count));
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <mutex>
+
+#include "macros/assert.hpp"
+#include "registry.hpp"
+
+auto Registry::slot_ref(const uint32_t slot) const -> std::atomic<std::shared_ptr<Daemon>>& {
+    return chunks[slot >> chunk_bits]->slots[slot & (chunk_size - 1)];
+}
+
+auto Registry::insert(std::shared_ptr<Daemon> daemon) -> Daemon* {
+    auto slot = uint32_t();
+    if(!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = slot_count.load(std::memory_order_relaxed);
+        ensure(slot < chunk_size * max_chunks, "too many daemons");
+        auto& chunk = chunks[slot >> chunk_bits];
+        if(!chunk) {
+            chunk.reset(new Chunk());
+        }
+    }
+    daemon->slot       = slot;
+    daemon->generation = next_generation;
+    next_generation += 1;
+
+    const auto ptr = daemon.get();
+    slot_ref(slot).store(std::move(daemon));
+    if(slot == slot_count.load(std::memory_order_relaxed)) {
+        // publishes the new chunk too
+        slot_count.store(slot + 1, std::memory_order_release);
+    }
+    const auto lock = std::unique_lock(names_lock);
+    names.emplace(ptr->name, slot);
+    return ptr;
+}
+
+auto Registry::erase(Daemon& daemon) -> void {
+    const auto slot = daemon.slot;
+    unbind_pid(daemon);
+    {
+        const auto lock = std::unique_lock(names_lock);
+        names.erase(daemon.name);
+    }
+    // daemon is destroyed here unless a reader still holds it
+    slot_ref(slot).store(nullptr);
+    free_slots.push_back(slot);
+}
+
+auto Registry::at(const uint32_t slot) const -> Daemon* {
+    return slot < size() ? slot_ref(slot).load().get() : nullptr;
+}
+
+auto Registry::find(const std::string_view name) const -> Daemon* {
+    const auto it = names.find(name);
+    return it != names.end() ? slot_ref(it->second).load().get() : nullptr;
+}
+
+auto Registry::find_by_pid(const pid_t pid) const -> Daemon* {
+    const auto it = pids.find(pid);
+    return it != pids.end() ? slot_ref(it->second).load().get() : nullptr;
+}
+
+auto Registry::bind_pid(Daemon& daemon) -> void {
+    pids.insert_or_assign(daemon.pid, daemon.slot);
+}
+
+auto Registry::unbind_pid(Daemon& daemon) -> void {
+    if(const auto it = pids.find(daemon.pid); it != pids.end() && it->second == daemon.slot) {
+        pids.erase(it);
+    }
+}
+
+auto Registry::size() const -> uint32_t {
+    return slot_count.load(std::memory_order_acquire);
+}
+
+auto Registry::load(const uint32_t slot) const -> std::shared_ptr<const Daemon> {
+    if(slot >= size()) {
+        return nullptr;
+    }
+    return slot_ref(slot).load();
+}
+
+auto Registry::lookup(const std::string_view name) const -> std::shared_ptr<const Daemon> {
+    const auto lock = std::shared_lock(names_lock);
+    const auto it   = names.find(name);
+    return it != names.end() ? slot_ref(it->second).load() : nullptr;
+}
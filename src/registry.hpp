@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "daemon.hpp"
+
+// owns every daemon
+// only the worker thread modifies the registry, readers on other threads use the any-thread functions
+class Registry {
+  private:
+    constexpr static auto chunk_bits = 10;
+    constexpr static auto chunk_size = size_t(1) << chunk_bits;
+    constexpr static auto max_chunks = size_t(4096);
+
+    struct StringHash {
+        using is_transparent = void;
+
+        auto operator()(const std::string_view str) const -> size_t {
+            return std::hash<std::string_view>()(str);
+        }
+    };
+
+    // chunks are never moved nor freed, so a slot can be indexed without locking
+    struct Chunk {
+        std::array<std::atomic<std::shared_ptr<Daemon>>, chunk_size> slots;
+    };
+
+    std::array<std::unique_ptr<Chunk>, max_chunks> chunks;
+    std::atomic_uint32_t                           slot_count = 0;
+    std::vector<uint32_t>                          free_slots;
+    uint64_t                                       next_generation = 1;
+
+    // protects names against readers, the worker thread reads it without locking
+    mutable std::shared_mutex                                           names_lock;
+    std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> names;
+    std::unordered_map<pid_t, uint32_t>                                 pids;
+
+    auto slot_ref(uint32_t slot) const -> std::atomic<std::shared_ptr<Daemon>>&;
+
+  public:
+    // worker thread
+    auto insert(std::shared_ptr<Daemon> daemon) -> Daemon*;
+    auto erase(Daemon& daemon) -> void;
+    auto at(uint32_t slot) const -> Daemon*;
+    auto find(std::string_view name) const -> Daemon*;
+    auto find_by_pid(pid_t pid) const -> Daemon*;
+    auto bind_pid(Daemon& daemon) -> void;
+    auto unbind_pid(Daemon& daemon) -> void;
+
+    // any thread
+    auto size() const -> uint32_t;
+    auto load(uint32_t slot) const -> std::shared_ptr<const Daemon>;
+    auto lookup(std::string_view name) const -> std::shared_ptr<const Daemon>;
+
+    template <class Fn>
+    auto for_each(Fn fn) const -> void;
+};
+
+template <class Fn>
+auto Registry::for_each(Fn fn) const -> void {
+    for(auto slot = uint32_t(0), count = size(); slot < count; slot += 1) {
+        if(const auto daemon = slot_ref(slot).load(); daemon) {
+            fn(*daemon);
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "completion.hpp"
+#include "macros/assert.hpp"
+#include "mpsc-queue.hpp"
+#include "util/event.hpp"
+#include "util/writers-reader-buffer.hpp"
+
+// round trips of an empty command between fuse threads and the worker
+// "event" is the previous WritersReaderBuffer + eventfd + Event path, "mpsc" is the current one
+namespace {
+constexpr auto ops_per_thread = 20'000;
+
+using Clock = std::chrono::steady_clock;
+
+struct EventRequest {
+    Event* event;
+    int*   result;
+};
+
+struct MpscRequest {
+    MpscRequest* next;
+    int          result;
+    Completion   done;
+};
+
+// worker side of both paths, waits on the eventfd like DaemonFS::run()
+template <class Drain>
+auto run_worker(const int eventfd, const std::atomic_bool& quit, Drain drain) -> void {
+    const auto epollfd = epoll_create1(EPOLL_CLOEXEC);
+    auto       event   = epoll_event{.events = EPOLLIN, .data = {.fd = eventfd}};
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, eventfd, &event);
+    while(!quit.load(std::memory_order_relaxed)) {
+        if(epoll_wait(epollfd, &event, 1, 10) != 1) {
+            continue;
+        }
+        auto buf = uint64_t();
+        read(eventfd, &buf, sizeof(buf));
+        drain();
+    }
+    close(epollfd);
+}
+
+template <class Call>
+auto measure(const char* const label, const int threads, Call call) -> void {
+    auto       latencies = std::vector<std::vector<Clock::duration>>(threads);
+    auto       clients   = std::vector<std::thread>();
+    const auto begin     = Clock::now();
+    for(auto i = 0; i < threads; i += 1) {
+        clients.emplace_back([&call, &latency = latencies[i]]() {
+            latency.reserve(ops_per_thread);
+            for(auto n = 0; n < ops_per_thread; n += 1) {
+                const auto start = Clock::now();
+                call();
+                latency.push_back(Clock::now() - start);
+            }
+        });
+    }
+    for(auto& client : clients) {
+        client.join();
+    }
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    auto all = std::vector<Clock::duration>();
+    for(const auto& latency : latencies) {
+        all.insert(all.end(), latency.begin(), latency.end());
+    }
+    const auto p99 = all.begin() + all.size() * 99 / 100;
+    std::nth_element(all.begin(), p99, all.end());
+    print(label, " threads=", threads, " ", size_t(all.size() / elapsed), "ops/s p99=", std::chrono::duration_cast<std::chrono::nanoseconds>(*p99).count(), "ns");
+}
+
+auto bench_event(const int threads) -> void {
+    const auto fd       = eventfd(0, EFD_CLOEXEC);
+    auto       quit     = std::atomic_bool(false);
+    auto       requests = WritersReaderBuffer<EventRequest>();
+    auto       worker   = std::thread([&]() {
+        run_worker(fd, quit, [&requests]() {
+            for(auto& request : requests.swap()) {
+                *request.result = 0;
+                request.event->notify();
+            }
+        });
+    });
+    measure("event", threads, [&]() {
+        auto event  = Event();
+        auto result = int();
+        requests.push(EventRequest{&event, &result});
+        auto buf = uint64_t(1);
+        write(fd, &buf, sizeof(buf));
+        event.wait();
+    });
+    quit = true;
+    worker.join();
+    close(fd);
+}
+
+auto bench_mpsc(const int threads) -> void {
+    const auto fd       = eventfd(0, EFD_CLOEXEC);
+    auto       quit     = std::atomic_bool(false);
+    auto       requests = MpscQueue<MpscRequest>();
+    auto       worker   = std::thread([&]() {
+        run_worker(fd, quit, [&requests]() {
+            requests.drain([](MpscRequest& request) {
+                request.result = 0;
+                request.done.notify();
+            });
+        });
+    });
+    measure("mpsc", threads, [&]() {
+        auto request = MpscRequest{};
+        if(requests.push(request)) {
+            auto buf = uint64_t(1);
+            write(fd, &buf, sizeof(buf));
+        }
+        request.done.wait();
+    });
+    quit = true;
+    worker.join();
+    close(fd);
+}
+} // namespace
+
+auto main() -> int {
+    for(const auto threads : {1, 4, 16}) {
+        bench_event(threads);
+        bench_mpsc(threads);
+    }
+    return 0;
+}
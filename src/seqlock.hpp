@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// single writer, many readers
+// readers never block the writer and never write to shared memory
+template <class T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    constexpr static auto words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    using Words = std::array<uint64_t, words>;
+
+    std::atomic_uint64_t                    sequence = 0;
+    std::array<std::atomic_uint64_t, words> data     = {};
+
+  public:
+    auto store(const T& value) -> void {
+        auto buf = Words();
+        std::memcpy(buf.data(), &value, sizeof(T));
+
+        const auto seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(auto i = 0u; i < words; i += 1) {
+            data[i].store(buf[i], std::memory_order_relaxed);
+        }
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    auto load() const -> T {
+        auto buf = Words();
+        while(true) {
+            const auto seq = sequence.load(std::memory_order_acquire);
+            if(seq & 1) {
+                continue;
+            }
+            for(auto i = 0u; i < words; i += 1) {
+                buf[i] = data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(sequence.load(std::memory_order_relaxed) == seq) {
+                break;
+            }
+        }
+        auto value = T();
+        std::memcpy(static_cast<void*>(&value), buf.data(), sizeof(T));
+        return value;
+    }
+};
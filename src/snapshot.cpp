@@ -0,0 +1,82 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "macros/assert.hpp"
+#include "snapshot.hpp"
+
+auto SnapshotWriter::put_string(const std::string_view str) -> void {
+    put(uint32_t(str.size()));
+    buf.append(str);
+}
+
+auto SnapshotWriter::data() const -> std::string_view {
+    return buf;
+}
+
+auto SnapshotReader::get_string(std::string& str) -> bool {
+    auto size = uint32_t();
+    ok        = get(size) && data.size() - pos >= size;
+    if(ok) {
+        str.assign(data.data() + pos, size);
+        pos += size;
+    }
+    return ok;
+}
+
+SnapshotReader::SnapshotReader(const std::span<const char> data)
+    : data(data) {
+}
+
+auto MappedFile::open(const char* const path, const int dir) -> bool {
+    const auto fd = openat(dir, path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        if(errno != ENOENT) {
+            warn("failed to open ", path, ": ", strerror(errno));
+        }
+        return false;
+    }
+    struct stat stat = {};
+    if(fstat(fd, &stat) != 0 || stat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    const auto ptr = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    ensure(ptr != MAP_FAILED, "mmap() failed: ", strerror(errno));
+    data = {static_cast<const char*>(ptr), size_t(stat.st_size)};
+    return true;
+}
+
+auto MappedFile::contents() const -> std::span<const char> {
+    return data;
+}
+
+MappedFile::~MappedFile() {
+    if(!data.empty()) {
+        munmap(const_cast<char*>(data.data()), data.size());
+    }
+}
+
+auto write_snapshot_file(const char* const path, const std::string_view data) -> bool {
+    const auto temp = std::string(path) + ".tmp";
+    const auto fd   = ::open(temp.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    ensure(fd >= 0, "failed to open ", temp, ": ", strerror(errno));
+    auto done = size_t(0);
+    while(done < data.size()) {
+        const auto len = ::write(fd, data.data() + done, data.size() - done);
+        if(len < 0) {
+            warn("failed to write ", temp, ": ", strerror(errno));
+            close(fd);
+            return false;
+        }
+        done += len;
+    }
+    // the rename must not become visible before the contents
+    const auto synced = fdatasync(fd) == 0;
+    close(fd);
+    ensure(synced, "fdatasync() failed: ", strerror(errno));
+    ensure(rename(temp.data(), path) == 0, "rename() failed: ", strerror(errno));
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <fcntl.h>
+
+// compact binary encoding of the state of daemonfs
+// values are stored in native layout, so a snapshot is only read back by the same build on the same machine
+class SnapshotWriter {
+  private:
+    std::string buf;
+
+  public:
+    template <class T>
+        requires std::is_trivially_copyable_v<T>
+    auto put(const T& value) -> void {
+        buf.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    auto put_string(std::string_view str) -> void;
+    auto data() const -> std::string_view;
+};
+
+// every get fails once the data ran out, so callers may check only the last one
+class SnapshotReader {
+  private:
+    std::span<const char> data;
+    size_t                pos = 0;
+    bool                  ok  = true;
+
+  public:
+    template <class T>
+        requires std::is_trivially_copyable_v<T>
+    auto get(T& value) -> bool {
+        ok = ok && data.size() - pos >= sizeof(T);
+        if(ok) {
+            std::memcpy(&value, data.data() + pos, sizeof(T));
+            pos += sizeof(T);
+        }
+        return ok;
+    }
+
+    auto get_string(std::string& str) -> bool;
+
+    SnapshotReader(std::span<const char> data);
+};
+
+// read-only mapping of a whole file
+class MappedFile {
+  private:
+    std::span<const char> data;
+
+  public:
+    // false if the file does not exist, warns on other errors
+    // a relative path is looked up in dir
+    auto open(const char* path, int dir = AT_FDCWD) -> bool;
+    auto contents() const -> std::span<const char>;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    ~MappedFile();
+};
+
+// writes to a temporary file and renames it over path, so a crash leaves either the old or the new snapshot
+auto write_snapshot_file(const char* path, std::string_view data) -> bool;
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cgroup.hpp"
+#include "daemon.hpp"
+#include "macros/assert.hpp"
+
+// time the worker thread spends launching one daemon, depending on how much memory daemonfs holds
+// "fork" is the previous fork() + execve() path, "spawn" is Daemon::start_process()
+// given a cgroup v2 directory, "spawn-cgroup" also places each child into a child cgroup of it like -c
+namespace {
+constexpr auto spawns = 200;
+
+using Clock = std::chrono::steady_clock;
+
+auto rss_mib() -> long {
+    auto usage = rusage();
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+}
+
+auto fork_exec(const char* const path) -> pid_t {
+    const auto pid = fork();
+    if(pid == 0) {
+        const auto argv = std::array{(char*)path, (char*)nullptr};
+        execve(path, argv.data(), environ);
+        _exit(1);
+    }
+    return pid;
+}
+
+template <class Spawn>
+auto measure(const char* const label, Spawn spawn) -> bool {
+    auto total = Clock::duration();
+    auto worst = Clock::duration();
+    for(auto i = 0; i < spawns; i += 1) {
+        const auto begin = Clock::now();
+        const auto pid   = spawn();
+        const auto took  = Clock::now() - begin;
+        ensure(pid > 0);
+        waitpid(pid, NULL, 0);
+        total += took;
+        worst = std::max(worst, took);
+    }
+    const auto to_us = [](const Clock::duration d) { return std::chrono::duration<double, std::micro>(d).count(); };
+    print(label, " rss=", rss_mib(), "MiB avg=", to_us(total) / spawns, "us max=", to_us(worst), "us");
+    return true;
+}
+
+auto start(Daemon& daemon) -> pid_t {
+    if(!daemon.start_process()) {
+        return -1;
+    }
+    close(daemon.stdout_fd);
+    close(daemon.stderr_fd);
+    return daemon.pid;
+}
+} // namespace
+
+auto main(const int argc, const char* const argv[]) -> int {
+    auto daemon  = Daemon{.name = "bench", .args = "/bin/true"};
+    auto placed  = Daemon{.name = "bench", .args = "/bin/true"};
+    auto root    = -1;
+    auto ballast = std::vector<std::vector<char>>();
+    if(argc > 1) {
+        root = open(argv[1], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        ensure(root >= 0, "failed to open ", argv[1], ": ", strerror(errno));
+        placed.cgroup_fd = cgroup::open(root, "spawn-bench");
+        ensure(placed.cgroup_fd >= 0);
+    }
+    for(const auto mib : {0, 256, 1024, 2048}) {
+        while(rss_mib() < mib) {
+            // touched, so that the pages are really mapped like filled rings
+            ballast.emplace_back(size_t(64) * 1024 * 1024, 1);
+        }
+        ensure(measure("fork", []() { return fork_exec("/bin/true"); }));
+        ensure(measure("spawn", [&daemon]() { return start(daemon); }));
+        if(root != -1) {
+            ensure(measure("spawn-cgroup", [&placed]() { return start(placed); }));
+        }
+    }
+    if(root != -1) {
+        close(placed.cgroup_fd);
+        placed.cgroup_fd = -1;
+        cgroup::remove(root, "spawn-bench");
+        close(root);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+// layout of /.status.bin, in native byte order
+// a StatusHeader, then count records, each followed by name_size bytes of name and zero padding up to a multiple of 8
+constexpr auto status_magic = uint64_t(0x31'74'61'74'73'73'66'64); // "dfsstat1"
+
+struct StatusHeader {
+    uint64_t magic;
+    uint32_t count;
+    uint32_t record_size; // sizeof(StatusRecord), fields are only ever appended
+};
+
+struct StatusRecord {
+    int64_t  state_changed_ms; // unix time
+    uint64_t stdout_used;      // bytes held in the ring
+    uint64_t stdout_capacity;
+    uint64_t stderr_used;
+    uint64_t stderr_capacity;
+    int32_t  pid; // 0 unless running
+    uint32_t restarts;
+    uint16_t name_size;
+    uint8_t  state; // as the State enum
+    uint8_t  reserved[5];
+};
+
+static_assert(sizeof(StatusHeader) == 16);
+static_assert(sizeof(StatusRecord) == 56);
@@ -1,5 +1,6 @@
 #include <chrono>
 
-using TimePoint = std::chrono::time_point<std::chrono::system_clock>;
+using TimePoint   = std::chrono::time_point<std::chrono::system_clock>;
+using SteadyPoint = std::chrono::time_point<std::chrono::steady_clock>;
 
 auto to_timespec(const TimePoint& time) -> timespec;
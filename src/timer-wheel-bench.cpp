@@ -0,0 +1,100 @@
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "macros/assert.hpp"
+#include "timer-wheel.hpp"
+
+// cost of arming, cancelling and firing timers, spread over an hour in 1ms ticks
+// "map" is an ordered multimap, the usual alternative which also supports cancel
+namespace {
+constexpr auto timers  = 100'000;
+constexpr auto horizon = uint64_t(3'600'000);
+
+using Clock = std::chrono::steady_clock;
+
+auto ns_per_op(const Clock::duration d, const size_t count) -> double {
+    return std::chrono::duration<double, std::nano>(d).count() / count;
+}
+
+auto make_expiries() -> std::vector<uint64_t> {
+    auto rng      = std::mt19937_64(1);
+    auto expiries = std::vector<uint64_t>(timers);
+    for(auto& expiry : expiries) {
+        expiry = 1 + rng() % horizon;
+    }
+    return expiries;
+}
+
+auto bench_wheel(const std::vector<uint64_t>& expiries) -> bool {
+    auto wheel = TimerWheel();
+    auto nodes = std::vector<TimerNode>(timers);
+
+    auto begin = Clock::now();
+    for(auto i = 0; i < timers; i += 1) {
+        wheel.arm(nodes[i], expiries[i]);
+    }
+    const auto arm = Clock::now() - begin;
+
+    begin = Clock::now();
+    for(auto i = 0; i < timers; i += 2) {
+        wheel.cancel(nodes[i]);
+    }
+    const auto cancel = Clock::now() - begin;
+
+    // driven like the event loop, which arms the timerfd for next_event()
+    auto fired = 0;
+    auto wakes = 0;
+    begin      = Clock::now();
+    while(const auto next = wheel.next_event()) {
+        for(auto node = wheel.advance(*next); node != nullptr; node = node->next) {
+            fired += 1;
+        }
+        wakes += 1;
+    }
+    const auto fire = Clock::now() - begin;
+    ensure(fired == timers / 2, "fired ", fired);
+
+    print("wheel timers=", timers, " arm=", ns_per_op(arm, timers), "ns cancel=", ns_per_op(cancel, timers / 2), "ns fire=", ns_per_op(fire, fired), "ns wakes=", wakes);
+    return true;
+}
+
+auto bench_map(const std::vector<uint64_t>& expiries) -> bool {
+    using Map = std::multimap<uint64_t, size_t>;
+
+    auto map     = Map();
+    auto handles = std::vector<Map::iterator>(timers);
+
+    auto begin = Clock::now();
+    for(auto i = 0; i < timers; i += 1) {
+        handles[i] = map.emplace(expiries[i], i);
+    }
+    const auto arm = Clock::now() - begin;
+
+    begin = Clock::now();
+    for(auto i = 0; i < timers; i += 2) {
+        map.erase(handles[i]);
+    }
+    const auto cancel = Clock::now() - begin;
+
+    auto fired = 0;
+    begin      = Clock::now();
+    while(!map.empty()) {
+        map.erase(map.begin());
+        fired += 1;
+    }
+    const auto fire = Clock::now() - begin;
+    ensure(fired == timers / 2, "fired ", fired);
+
+    print("map   timers=", timers, " arm=", ns_per_op(arm, timers), "ns cancel=", ns_per_op(cancel, timers / 2), "ns fire=", ns_per_op(fire, fired), "ns");
+    return true;
+}
+} // namespace
+
+auto main() -> int {
+    const auto expiries = make_expiries();
+    ensure(bench_map(expiries));
+    ensure(bench_wheel(expiries));
+    return 0;
+}
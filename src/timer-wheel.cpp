@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <bit>
+
+#include "timer-wheel.hpp"
+
+auto TimerWheel::place(TimerNode& node) -> void {
+    const auto delta  = std::min(node.expiry - current, max_delta);
+    const auto target = current + delta;
+    const auto level  = (std::bit_width(delta) - 1) / slot_bits;
+    const auto slot   = (target >> (slot_bits * level)) & slot_mask;
+    node.bucket       = level * slots + slot;
+
+    auto& head      = buckets[node.bucket];
+    node.prev       = head.prev;
+    node.next       = &head;
+    head.prev->next = &node;
+    head.prev       = &node;
+    occupied[level] |= uint64_t(1) << slot;
+}
+
+auto TimerWheel::unlink(TimerNode& node) -> void {
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev       = nullptr;
+    node.next       = nullptr;
+    if(auto& head = buckets[node.bucket]; head.next == &head) {
+        occupied[node.bucket / slots] &= ~(uint64_t(1) << (node.bucket & slot_mask));
+    }
+}
+
+auto TimerWheel::take(const size_t bucket, TimerNode*& list) -> void {
+    auto& head = buckets[bucket];
+    for(auto node = head.next; node != &head;) {
+        const auto next = node->next;
+        node->prev      = nullptr;
+        node->next      = list;
+        list            = node;
+        node            = next;
+    }
+    head.prev = &head;
+    head.next = &head;
+    occupied[bucket / slots] &= ~(uint64_t(1) << (bucket & slot_mask));
+}
+
+auto TimerWheel::now() const -> Tick {
+    return current;
+}
+
+auto TimerWheel::arm(TimerNode& node, const Tick expiry) -> void {
+    if(node.is_armed()) {
+        unlink(node);
+    }
+    node.expiry = std::max(expiry, current + 1);
+    place(node);
+}
+
+auto TimerWheel::cancel(TimerNode& node) -> void {
+    if(node.is_armed()) {
+        unlink(node);
+    }
+}
+
+auto TimerWheel::next_event() const -> std::optional<Tick> {
+    auto next = std::optional<Tick>();
+    for(auto level = 0; level < levels; level += 1) {
+        if(occupied[level] == 0) {
+            continue;
+        }
+        // bit 0 of rotated is the slot after the current one
+        const auto shift    = slot_bits * level;
+        const auto index    = (current >> shift) & slot_mask;
+        const auto rotated  = std::rotr(occupied[level], int((index + 1) & slot_mask));
+        const auto distance = Tick(std::countr_zero(rotated)) + 1;
+        const auto tick     = ((current >> shift) + distance) << shift;
+        next                = std::min(next.value_or(tick), tick);
+    }
+    return next;
+}
+
+auto TimerWheel::advance(const Tick to) -> TimerNode* {
+    auto expired = (TimerNode*)(nullptr);
+    while(current < to) {
+        // jumps over ticks with nothing to fire nor cascade
+        const auto next = next_event();
+        if(!next || *next > to) {
+            current = to;
+            break;
+        }
+        current = *next;
+
+        // timers moved down never land in a bucket which is cascaded at the same tick, so the order does not matter
+        auto top = 0;
+        while(top + 1 < levels && (current & ((Tick(1) << (slot_bits * (top + 1))) - 1)) == 0) {
+            top += 1;
+        }
+        for(auto level = top; level >= 1; level -= 1) {
+            auto moved = (TimerNode*)(nullptr);
+            take(level * slots + ((current >> (slot_bits * level)) & slot_mask), moved);
+            while(moved != nullptr) {
+                const auto node = moved;
+                moved           = node->next;
+                if(node->expiry <= current) {
+                    node->next = expired;
+                    expired    = node;
+                } else {
+                    place(*node);
+                }
+            }
+        }
+        take(current & slot_mask, expired);
+    }
+    return expired;
+}
+
+TimerWheel::TimerWheel() {
+    for(auto& head : buckets) {
+        head.prev = &head;
+        head.next = &head;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+
+// intrusive timer, embedded in the object which owns it
+// the owner must cancel it before it is destroyed
+struct TimerNode {
+    TimerNode* prev   = nullptr; // nullptr while not armed
+    TimerNode* next   = nullptr;
+    uint64_t   expiry = 0;       // in ticks
+    uint16_t   bucket = 0;
+    void*      data   = nullptr; // left to the owner
+
+    auto is_armed() const -> bool {
+        return prev != nullptr;
+    }
+};
+
+// hierarchical timer wheel
+// level n holds the timers which expire within 64^(n + 1) ticks, in slots of 64^n ticks
+// timers of upper levels are moved down when the lower levels wrap around, so arm and cancel are O(1)
+class TimerWheel {
+  public:
+    using Tick = uint64_t;
+
+  private:
+    constexpr static auto slot_bits = 6;
+    constexpr static auto slots     = size_t(1) << slot_bits;
+    constexpr static auto slot_mask = slots - 1;
+    constexpr static auto levels    = 4;
+    // farther timers are kept in the last slot of the top level and placed again when it is cascaded
+    constexpr static auto max_delta = (Tick(1) << (slot_bits * levels)) - 1;
+
+    // heads of circular lists
+    std::array<TimerNode, slots * levels> buckets;
+    std::array<uint64_t, levels>          occupied = {}; // bitmap of non-empty slots per level
+    Tick                                  current  = 0;
+
+    auto place(TimerNode& node) -> void;
+    auto unlink(TimerNode& node) -> void;
+    auto cascade(int level) -> void;
+    // moves every timer of the bucket into list
+    auto take(size_t bucket, TimerNode*& list) -> void;
+
+  public:
+    auto now() const -> Tick;
+    // rearms the node if it is armed already
+    // expiries not after now() fire on the next tick
+    auto arm(TimerNode& node, Tick expiry) -> void;
+    auto cancel(TimerNode& node) -> void;
+    // the earliest tick at which advance() has something to do, exact for the first level and a lower bound otherwise
+    auto next_event() const -> std::optional<Tick>;
+    // moves the wheel to the tick and returns the expired timers linked through TimerNode::next
+    // returned nodes are not armed, arming one rewrites its next, so walk a copy if handlers may arm any of them
+    auto advance(Tick to) -> TimerNode*;
+
+    TimerWheel();
+    TimerWheel(const TimerWheel&) = delete;
+};
@@ -0,0 +1,34 @@
+#!/bin/zsh
+# measures how fast daemonfs ingests output of noisy children
+# usage: bench-ingest.sh [CHILDREN] [BYTES_PER_CHILD]
+set -e
+
+rootfs="mnt"
+children=${1:-8}
+bytes=${2:-268435456}
+
+for i in $(seq $children); do
+    mkdir $rootfs/noisy$i
+    printf '%s\n' /usr/bin/head -c $bytes /dev/zero > $rootfs/noisy$i/args
+    echo never > $rootfs/noisy$i/restart
+    truncate -s 1048576 $rootfs/noisy$i/stdout
+done
+
+start=$(date +%s.%N)
+for i in $(seq $children); do
+    echo up > $rootfs/noisy$i/state
+done
+for i in $(seq $children); do
+    while [[ $(cat $rootfs/noisy$i/state) == up ]]; do
+        sleep 0.01
+    done
+done
+end=$(date +%s.%N)
+
+elapsed=$(($end - $start))
+total=$(($children * $bytes))
+printf "children=%d bytes=%d elapsed=%.3fs throughput=%.1fMiB/s\n" $children $total $elapsed $(($total / $elapsed / 1048576))
+
+for i in $(seq $children); do
+    rmdir $rootfs/noisy$i
+done
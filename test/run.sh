@@ -9,6 +9,8 @@ echo "$PWD/example2d.sh" > $rootfs/e2d/args
 echo "$PWD/example3d.sh" > $rootfs/e3d/args
 truncate -s 4096 $rootfs/e1d/stdout
 truncate -s 4096 $rootfs/e1d/stderr
+echo 1000 > $rootfs/e1d/ready
+echo e1d > $rootfs/e2d/depends
 echo up > $rootfs/e1d/state
 echo up > $rootfs/e2d/state
 echo up > $rootfs/e3d/state